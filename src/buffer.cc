@@ -13,6 +13,8 @@
 namespace Kakoune
 {
 
+static size_t next_buffer_id = 0;
+
 Buffer::Buffer(String name, Flags flags, std::vector<String> lines,
                time_t fs_timestamp)
     : m_name(flags & Flags::File ? real_path(parse_filename(name)) : std::move(name)),
@@ -20,6 +22,7 @@ Buffer::Buffer(String name, Flags flags, std::vector<String> lines,
       m_history(), m_history_cursor(m_history.begin()),
       m_last_save_undo_index(0),
       m_timestamp(0),
+      m_id(next_buffer_id++),
       m_fs_timestamp(fs_timestamp),
       m_hooks(GlobalHooks::instance()),
       m_options(GlobalOptions::instance()),
@@ -71,6 +74,7 @@ Buffer::~Buffer()
 
 void Buffer::reload(std::vector<String> lines, time_t fs_timestamp)
 {
+    record_change({ Change::Erase, {0,0}, end_coord(), m_timestamp + 1 });
     for (auto listener : m_change_listeners)
         listener->on_erase(*this, {0,0}, end_coord());
 
@@ -94,6 +98,7 @@ void Buffer::reload(std::vector<String> lines, time_t fs_timestamp)
     }
     m_fs_timestamp = fs_timestamp;
 
+    record_change({ Change::Insert, {0,0}, end_coord(), m_timestamp });
     for (auto listener : m_change_listeners)
         listener->on_insert(*this, {0,0}, end_coord());
 }
@@ -543,6 +548,7 @@ BufferCoord Buffer::do_insert(BufferCoord pos, const String& content)
         end = BufferCoord{ last_line, m_lines[last_line].length() - suffix.length() };
     }
 
+    record_change({ Change::Insert, begin, end, m_timestamp });
     for (auto listener : m_change_listeners)
         listener->on_insert(*this, begin, end);
     return begin;
@@ -574,11 +580,41 @@ BufferCoord Buffer::do_erase(BufferCoord begin, BufferCoord end)
     for (LineCount i = begin.line+1; i < line_count(); ++i)
         m_lines[i].start -= length;
 
+    record_change({ Change::Erase, begin, end, m_timestamp });
     for (auto listener : m_change_listeners)
         listener->on_erase(*this, begin, end);
     return next;
 }
 
+void Buffer::record_change(Change change)
+{
+    // the journal is bounded, the oldest half of it is discarded once full
+    // and the consumers which did not catch up need to start over.
+    constexpr size_t max_changes = 4096;
+    if (m_changes.size() == max_changes)
+    {
+        auto it = m_changes.begin() + max_changes / 2;
+        m_discarded_changes_timestamp = (it-1)->timestamp;
+        // changes done at the same timestamp are discarded together
+        while (it != m_changes.end() and it->timestamp == m_discarded_changes_timestamp)
+            ++it;
+        m_changes.erase(m_changes.begin(), it);
+    }
+    m_changes.push_back(change);
+}
+
+boost::optional<memoryview<Buffer::Change>> Buffer::changes_since(size_t timestamp) const
+{
+    if (timestamp < m_discarded_changes_timestamp)
+        return boost::none;
+
+    auto it = std::upper_bound(m_changes.begin(), m_changes.end(), timestamp,
+                               [](size_t ts, const Change& change)
+                               { return ts < change.timestamp; });
+    return memoryview<Change>{ m_changes.data() + (it - m_changes.begin()),
+                               m_changes.data() + m_changes.size() };
+}
+
 void Buffer::apply_modification(const Modification& modification)
 {
     const String& content = modification.content;
@@ -5,6 +5,7 @@
 #include "hook_manager.hh"
 #include "option_manager.hh"
 #include "keymap_manager.hh"
+#include "memoryview.hh"
 #include "string.hh"
 #include "units.hh"
 
@@ -13,6 +14,8 @@
 #include <memory>
 #include <unordered_set>
 
+#include <boost/optional.hpp>
+
 namespace Kakoune
 {
 
@@ -108,6 +111,9 @@ public:
     BufferIterator erase(BufferIterator begin, BufferIterator end);
 
     size_t         timestamp() const { return m_timestamp; }
+    // unique during the whole process, unlike the buffer address which
+    // can be reused by a buffer created once this one is deleted.
+    size_t         id() const { return m_id; }
     time_t         fs_timestamp() const;
     void           set_fs_timestamp(time_t ts);
 
@@ -171,6 +177,21 @@ public:
 
     std::unordered_set<BufferChangeListener*>& change_listeners() const { return m_change_listeners; }
 
+    // a Change records an insertion or an erasure, begin and end are the
+    // coordinates of the inserted or erased text when it was applied.
+    struct Change
+    {
+        enum Type { Insert, Erase };
+        Type type;
+        BufferCoord begin;
+        BufferCoord end;
+        size_t timestamp; // buffer timestamp once applied
+    };
+    // changes applied after given timestamp, in application order. Only
+    // the last changes are kept, none is returned if some of the changes
+    // applied after timestamp were already discarded.
+    boost::optional<memoryview<Change>> changes_since(size_t timestamp) const;
+
     void reload(std::vector<String> lines, time_t fs_timestamp = InvalidTime);
 
     void check_invariant() const;
@@ -215,6 +236,13 @@ private:
     size_t m_last_save_undo_index;
     size_t m_timestamp;
 
+    void record_change(Change change);
+    std::vector<Change> m_changes;
+    // changes applied up to this timestamp are not in m_changes anymore
+    size_t m_discarded_changes_timestamp = 0;
+
+    size_t m_id;
+
     time_t m_fs_timestamp;
 
     // this is mutable as adding or removing listeners is not muting the
@@ -0,0 +1,65 @@
+#ifndef buffer_cache_hh_INCLUDED
+#define buffer_cache_hh_INCLUDED
+
+#include "buffer.hh"
+#include "buffer_manager.hh"
+
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Kakoune
+{
+
+// BufferCache holds some state for each buffer, keyed by buffer id. The
+// entries of deleted buffers are evicted the first time the cache is
+// accessed after a buffer deletion.
+template<typename Value>
+class BufferCache
+{
+public:
+    Value& operator[](const Buffer& buffer)
+    {
+        evict_deleted_ifn();
+        return m_values[buffer.id()];
+    }
+
+    Value* find(size_t buffer_id)
+    {
+        evict_deleted_ifn();
+        auto it = m_values.find(buffer_id);
+        return it != m_values.end() ? &it->second : nullptr;
+    }
+
+    size_t size() const { return m_values.size(); }
+
+    using iterator = typename std::unordered_map<size_t, Value>::iterator;
+    iterator begin() { evict_deleted_ifn(); return m_values.begin(); }
+    iterator end() { return m_values.end(); }
+
+private:
+    void evict_deleted_ifn()
+    {
+        const BufferManager& manager = BufferManager::instance();
+        if (m_deleted_count == manager.deleted_count())
+            return;
+        m_deleted_count = manager.deleted_count();
+
+        std::unordered_set<size_t> ids;
+        for (auto& buffer : manager)
+            ids.insert(buffer->id());
+        for (auto it = m_values.begin(); it != m_values.end(); )
+        {
+            if (ids.count(it->first))
+                ++it;
+            else
+                it = m_values.erase(it);
+        }
+    }
+
+    std::unordered_map<size_t, Value> m_values;
+    size_t m_deleted_count = 0;
+};
+
+}
+
+#endif // buffer_cache_hh_INCLUDED
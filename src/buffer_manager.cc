@@ -38,6 +38,7 @@ void BufferManager::unregister_buffer(Buffer& buffer)
         if (*it == &buffer)
         {
             m_buffers.erase(it);
+            ++m_deleted_count;
             return;
         }
     }
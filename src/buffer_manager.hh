@@ -29,6 +29,9 @@ public:
     iterator end() const { return m_buffers.cend(); }
     size_t   count() const { return m_buffers.size(); }
 
+    // number of buffers unregistered since startup
+    size_t   deleted_count() const { return m_deleted_count; }
+
     Buffer* get_buffer_ifp(const String& name);
     Buffer& get_buffer(const String& name);
     void    set_last_used_buffer(Buffer& buffer);
@@ -38,6 +41,7 @@ public:
 
 private:
     BufferList m_buffers;
+    size_t     m_deleted_count = 0;
 };
 
 }
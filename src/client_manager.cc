@@ -160,10 +160,27 @@ Client& ClientManager::get_client(const String& name)
     return *client;
 }
 
-void ClientManager::redraw_clients() const
+void ClientManager::redraw_clients()
 {
+    ++m_redraw_count;
     for (auto& client : m_clients)
         client->redraw_ifn();
 }
 
+void ClientManager::invalidate_buffer_windows(const Buffer& buffer) const
+{
+    for (auto& client : m_clients)
+    {
+        if (&client->context().buffer() == &buffer)
+            client->context().window().forget_timestamp();
+    }
+}
+
+size_t ClientManager::buffer_window_count(const Buffer& buffer) const
+{
+    return std::count_if(m_clients.begin(), m_clients.end(),
+                         [&](const std::unique_ptr<Client>& client)
+                         { return &client->context().buffer() == &buffer; });
+}
+
 }
@@ -28,7 +28,14 @@ public:
     WindowAndSelections get_free_window(Buffer& buffer);
     void add_free_window(std::unique_ptr<Window>&& window, SelectionList selections);
 
-    void redraw_clients() const;
+    void redraw_clients();
+    // incremented on each redraw_clients call, data depending on
+    // the global state can be cached for the duration of a redraw.
+    size_t redraw_count() const { return m_redraw_count; }
+    // windows displaying buffer will be redrawn even if it did not change
+    void invalidate_buffer_windows(const Buffer& buffer) const;
+    // number of client windows displaying buffer
+    size_t buffer_window_count(const Buffer& buffer) const;
 
     Client*  get_client_ifp(const String& name);
     Client&  get_client(const String& name);
@@ -40,6 +47,7 @@ private:
 
     std::vector<std::unique_ptr<Client>> m_clients;
     std::vector<WindowAndSelections> m_free_windows;
+    size_t m_redraw_count = 0;
 };
 
 }
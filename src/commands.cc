@@ -12,10 +12,13 @@
 #include "file.hh"
 #include "highlighter.hh"
 #include "highlighters.hh"
+#include "line_regex.hh"
 #include "client.hh"
 #include "option_manager.hh"
 #include "option_types.hh"
 #include "parameters_parser.hh"
+#include "profiler.hh"
+#include "regex_budget.hh"
 #include "register_manager.hh"
 #include "shell_manager.hh"
 #include "string.hh"
@@ -236,13 +239,84 @@ void set_buffer_name(CommandParameters params, Context& context)
         throw runtime_error("unable to change buffer name to " + parser[0]);
 }
 
+void grep_buffers(CommandParameters params, Context& context)
+{
+    ParametersParser parser(params, OptionMap{},
+                            ParametersParser::Flags::None, 1, 1);
+    Regex regex;
+    try
+    {
+        regex = Regex{parser[0]};
+    }
+    catch (boost::regex_error& err)
+    {
+        throw runtime_error("regex error: "_str + err.what());
+    }
+
+    const LineRegex line_regex{parser[0]};
+    static const String results_name = "*search*";
+    std::vector<String> results;
+    RegexBudget budget;
+    try
+    {
+        for (auto& buffer : BufferManager::instance())
+        {
+            if (buffer->name() == results_name)
+                continue;
+
+            const String name = buffer->display_name();
+            for (LineCount line = 0; line < buffer->line_count(); ++line)
+            {
+                budget.check();
+                // match directly in the line content, matches do not span lines
+                const String& content = (*buffer)[line];
+                const char* begin = content.c_str();
+                const char* end = begin + (int)content.length();
+                auto add_result = [&](const char* match_begin) {
+                    if (match_begin != end)
+                        results.push_back(name + ":" + to_string((int)line + 1) + ":" +
+                                          to_string((int)(match_begin - begin) + 1) +
+                                          ": " + content);
+                };
+                if (not line_regex.empty())
+                {
+                    line_regex.for_each_match(begin, end,
+                        [&](const LineRegex::Captures& captures) { add_result(captures[0]); });
+                    continue;
+                }
+                using BudgetCharIterator = BudgetIterator<const char*>;
+                boost::regex_iterator<BudgetCharIterator> re_it{{begin, budget}, {end, budget}, regex};
+                boost::regex_iterator<BudgetCharIterator> re_end;
+                for (; re_it != re_end; ++re_it)
+                    add_result((*re_it)[0].first.base());
+            }
+        }
+    }
+    catch (std::runtime_error& err)
+    {
+        // boost gave up on a too complex match
+        throw runtime_error(err.what());
+    }
+    if (results.empty())
+        throw runtime_error("'" + parser[0] + "': no matches found");
+
+    BufferManager::instance().delete_buffer_if_exists(results_name);
+    Buffer* buffer = new Buffer(results_name, Buffer::Flags::None, std::move(results));
+    buffer->options().get_local_option("filetype").set<String>("grep");
+
+    context.push_jump();
+    context.change_buffer(*buffer);
+}
+
 void define_highlighter(CommandParameters params, Context& context)
 {
     if (params.size() != 1)
         throw wrong_argument_count();
 
     const String& name = params[0];
-    DefinedHighlighters::instance().append({name, HighlighterGroup{}});
+    DefinedHighlighters& defined = DefinedHighlighters::instance();
+    defined.append({name, HighlighterGroup{}});
+    defined.notify_modified();
 }
 
 void add_highlighter(CommandParameters params, Context& context)
@@ -272,6 +346,8 @@ void add_highlighter(CommandParameters params, Context& context)
     }
 
     group->append(registry[name](highlighter_params));
+    if (parser.has_option("def-group"))
+        DefinedHighlighters::instance().notify_modified();
 }
 
 void rm_highlighter(CommandParameters params, Context& context)
@@ -423,6 +499,15 @@ void echo_message(CommandParameters params, Context& context)
 
 void write_debug_message(CommandParameters params, Context&)
 {
+    // 'debug highlighters' dumps the timings recorded while the
+    // profile_highlighters option is set
+    if (params.size() == 1 and params[0] == "highlighters")
+    {
+        for (auto& line : Profiler::instance().report())
+            write_debug(line);
+        return;
+    }
+
     String message;
     for (auto& param : params)
         message += param + " ";
@@ -836,6 +921,7 @@ void register_commands()
     cm.register_commands({ "delbuf", "db" }, delete_buffer<false>, CommandFlags::None, buffer_completer);
     cm.register_commands({ "delbuf!", "db!" }, delete_buffer<true>, CommandFlags::None, buffer_completer);
     cm.register_commands({ "namebuf", "nb" }, set_buffer_name);
+    cm.register_command("grepbuf", grep_buffers);
 
     auto get_highlighters = [](const Context& c) -> HighlighterGroup& { return c.window().highlighters(); };
     cm.register_commands({ "addhl", "ah" }, add_highlighter, CommandFlags::None, group_add_completer<HighlighterRegistry>(get_highlighters));
@@ -34,7 +34,7 @@ public:
     Context& operator=(const Context&) = delete;
 
     Buffer& buffer() const;
-    bool has_buffer() const { return m_selections; }
+    bool has_buffer() const { return (bool)m_selections; }
 
     Window& window() const;
     bool has_window() const { return (bool)m_window; }
@@ -5,6 +5,8 @@
 namespace Kakoune
 {
 
+constexpr BufferRange init_range{ {INT_MAX, INT_MAX}, {INT_MIN, INT_MIN} };
+
 void DisplayAtom::trim_begin(CharCount count)
 {
     if (m_type == BufferRange)
@@ -48,8 +50,10 @@ DisplayLine::iterator DisplayLine::split(iterator it, BufferCoord pos)
     kak_assert(it->begin() < pos);
     kak_assert(it->end() > pos);
 
-    DisplayAtom atom = *it;
-    atom.m_end = pos;
+    // only buffer ranges are split, there is no text to copy
+    DisplayAtom atom{*it->m_buffer, it->m_begin, pos};
+    atom.colors = it->colors;
+    atom.attribute = it->attribute;
     it->m_begin = pos;
     atom.check_invariant();
     it->check_invariant();
@@ -83,6 +87,13 @@ DisplayLine::iterator DisplayLine::erase(iterator beg, iterator end)
     return res;
 }
 
+void DisplayLine::clear()
+{
+    m_atoms.clear();
+    m_prefix.clear();
+    m_range = init_range;
+}
+
 void DisplayLine::optimize()
 {
     if (m_atoms.empty())
@@ -132,6 +143,14 @@ CharCount DisplayLine::length() const
     return len;
 }
 
+CharCount DisplayLine::prefix_length() const
+{
+    CharCount len = 0;
+    for (auto& atom : m_prefix)
+        len += atom.length();
+    return len;
+}
+
 void DisplayLine::trim(CharCount first_char, CharCount char_count)
 {
     for (auto it = begin(); first_char > 0 and it != end(); )
@@ -165,8 +184,6 @@ void DisplayLine::trim(CharCount first_char, CharCount char_count)
     compute_range();
 }
 
-constexpr BufferRange init_range{ {INT_MAX, INT_MAX}, {INT_MIN, INT_MIN} };
-
 void DisplayLine::compute_range()
 {
     m_range = init_range;
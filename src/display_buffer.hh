@@ -4,6 +4,7 @@
 #include "buffer.hh"
 #include "color.hh"
 #include "line_and_column.hh"
+#include "memoryview.hh"
 #include "string.hh"
 #include "utf8.hh"
 
@@ -57,13 +58,40 @@ public:
         return 0;
     }
 
+    // content of the atom without copying it, valid as long as the atom
+    // and its buffer are not modified. Buffer range atoms never span more
+    // than one buffer line, so their content is a part of that line.
+    memoryview<char> content_view() const
+    {
+        switch (m_type)
+        {
+            case BufferRange:
+            {
+                kak_assert(m_begin.line == m_end.line or
+                           (m_begin.line + 1 == m_end.line and m_end.column == 0));
+                const String& line = (*m_buffer)[m_begin.line];
+                const char* begin = line.c_str();
+                return { begin + (int)m_begin.column,
+                         begin + (int)(m_begin.line == m_end.line ? m_end.column
+                                                                  : line.length()) };
+            }
+            case Text:
+            case ReplacedBufferRange:
+               return { m_text.c_str(), m_text.c_str() + (int)m_text.length() };
+        }
+        kak_assert(false);
+        return {};
+    }
+
     CharCount length() const
     {
         switch (m_type)
         {
             case BufferRange:
-               return utf8::distance(m_buffer->iterator_at(m_begin),
-                                     m_buffer->iterator_at(m_end));
+            {
+                auto content = content_view();
+                return utf8::distance(content.begin(), content.end());
+            }
             case Text:
             case ReplacedBufferRange:
                return m_text.char_length();
@@ -140,16 +168,41 @@ public:
 
     const AtomList& atoms() const { return m_atoms; }
 
+    // atoms displayed before the line content, such as line numbers. They
+    // are not part of the content, so highlighters working on content atoms
+    // never need to skip or shift them.
+    AtomList&       prefix() { return m_prefix; }
+    const AtomList& prefix() const { return m_prefix; }
+
     CharCount length() const;
+    CharCount prefix_length() const;
     const BufferRange& range() const { return m_range; }
 
     // Split atom pointed by it at pos, returns an iterator to the first atom
     iterator split(iterator it, BufferCoord pos);
 
     iterator insert(iterator it, DisplayAtom atom);
+    template<typename It>
+    iterator insert(iterator it, It beg, It end)
+    {
+        for (auto atom_it = beg; atom_it != end; ++atom_it)
+        {
+            const DisplayAtom& atom = *atom_it;
+            if (atom.has_buffer_range())
+            {
+                m_range.first  = std::min(m_range.first, atom.begin());
+                m_range.second = std::max(m_range.second, atom.end());
+            }
+        }
+        return m_atoms.insert(it, beg, end);
+    }
     iterator erase(iterator beg, iterator end);
     void     push_back(DisplayAtom atom);
 
+    // remove every atom, keeping the allocated storage so that the line
+    // can be filled again without allocating.
+    void     clear();
+
     // remove first_char from the begining of the line, and make sure
     // the line is less that char_count character
     void trim(CharCount first_char, CharCount char_count);
@@ -159,6 +212,7 @@ private:
     void compute_range();
     BufferRange m_range = { { INT_MAX, INT_MAX }, { INT_MIN, INT_MIN } };
     AtomList  m_atoms;
+    AtomList  m_prefix;
 };
 
 class DisplayBuffer
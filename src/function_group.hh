@@ -3,6 +3,7 @@
 
 #include "exception.hh"
 #include "id_map.hh"
+#include "profiler.hh"
 #include "string.hh"
 
 namespace Kakoune
@@ -18,7 +19,10 @@ public:
     void operator()(Args&&... args)
     {
         for (auto& func : m_functions)
+        {
+           Profiler::Section section{func.first};
            func.second(std::forward<Args>(args)...);
+        }
     }
 
     void append(FunctionAndId&& function)
@@ -62,6 +66,10 @@ public:
             });
     }
 
+    using const_iterator = typename id_map<Function>::const_iterator;
+    const_iterator begin() const { return m_functions.begin(); }
+    const_iterator end() const { return m_functions.end(); }
+
 private:
     id_map<Function> m_functions;
 };
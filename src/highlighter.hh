@@ -8,6 +8,8 @@
 #include "utils.hh"
 
 #include <functional>
+#include <memory>
+#include <unordered_map>
 
 namespace Kakoune
 {
@@ -32,9 +34,27 @@ struct HighlighterRegistry : FunctionRegistry<HighlighterFactory>,
                              Singleton<HighlighterRegistry>
 {};
 
+struct DefinedGroupState;
+
 struct DefinedHighlighters : public HighlighterGroup,
                              public Singleton<DefinedHighlighters>
 {
+    DefinedHighlighters();
+    ~DefinedHighlighters();
+
+    // incremented each time the defined highlighters are modified, so that
+    // references to them can be resolved once per generation.
+    size_t generation() const { return m_generation; }
+    void   notify_modified();
+
+    // state the highlighters referencing a defined group share, dropped
+    // when the defined highlighters are modified.
+    DefinedGroupState& group_state(HighlighterGroup& group);
+
+private:
+    size_t m_generation = 0;
+    std::unordered_map<const HighlighterGroup*,
+                       std::unique_ptr<DefinedGroupState>> m_group_states;
 };
 
 }
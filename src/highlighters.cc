@@ -1,64 +1,47 @@
 #include "highlighters.hh"
 
 #include "assert.hh"
+#include "buffer_cache.hh"
+#include "client_manager.hh"
 #include "color_registry.hh"
 #include "context.hh"
+#include "debug.hh"
 #include "display_buffer.hh"
+#include "event_manager.hh"
+#include "line_regex.hh"
+#include "memoryview.hh"
 #include "option_types.hh"
+#include "profiler.hh"
+#include "regex_budget.hh"
 #include "register_manager.hh"
 #include "string.hh"
 #include "utf8.hh"
 #include "utf8_iterator.hh"
 
-#include <sstream>
+#include <bitset>
 #include <locale>
+#include <map>
 
 namespace Kakoune
 {
 
 using namespace std::placeholders;
 
-typedef boost::regex_iterator<BufferIterator> RegexIterator;
+// highlighters match on budgeted iterators, so that a pathological regex
+// only blocks a redraw for a bounded time. On budget expiry they display
+// nothing rather than propagating the error.
+using BudgetBufferIterator = BudgetIterator<BufferIterator>;
+typedef boost::regex_iterator<BudgetBufferIterator> RegexIterator;
+static constexpr std::chrono::milliseconds highlighter_budget{500};
 
 template<typename T>
 void highlight_range(DisplayBuffer& display_buffer,
                      BufferCoord begin, BufferCoord end,
                      bool skip_replaced, T func)
 {
-    if (begin == end or end <= display_buffer.range().first
-                     or begin >= display_buffer.range().second)
-        return;
-
-    for (auto& line : display_buffer.lines())
-    {
-        auto& range = line.range();
-        if (range.second <= begin or  end < range.first)
-            continue;
-
-        for (auto atom_it = line.begin(); atom_it != line.end(); ++atom_it)
-        {
-            bool is_replaced = atom_it->type() == DisplayAtom::ReplacedBufferRange;
-
-            if (not atom_it->has_buffer_range() or
-                (skip_replaced and is_replaced))
-                continue;
-
-            if (end <= atom_it->begin() or begin >= atom_it->end())
-                continue;
-
-            if (not is_replaced and begin > atom_it->begin())
-                atom_it = ++line.split(atom_it, begin);
-
-            if (not is_replaced and end < atom_it->end())
-            {
-                atom_it = line.split(atom_it, end);
-                func(*atom_it);
-                ++atom_it;
-            }
-            else
-                func(*atom_it);
-        }
-    }
+    BufferRange range{begin, end};
+    highlight_ranges(display_buffer, range, skip_replaced,
+                     [&](DisplayAtom& atom, size_t) { func(atom); });
 }
 
 template<typename T>
@@ -112,7 +95,7 @@ void apply_highlighter(const Context& context,
                 if (atom_it->end() >= end)
                 {
                     if (is_replaced or atom_it->end() == end)
-                        beg_idx = atom_it - line.begin();
+                        end_idx = atom_it - line.begin() + 1;
                     else
                     {
                         atom_it = ++line.split(atom_it, end);
@@ -134,16 +117,63 @@ void apply_highlighter(const Context& context,
     region_display.compute_range();
     highlighter(context, region_display);
 
+    // put the region atoms back in one insertion per line, lines which
+    // were entirely in the region are moved back as a whole.
     for (size_t i = 0; i < region_lines.size(); ++i)
     {
         auto& line = *(first_line + i);
-        auto pos = insert_pos[i];
-        for (auto& atom : region_lines[i])
-            pos = ++line.insert(pos, std::move(atom));
+        auto& region_line = region_lines[i];
+        if (line.atoms().empty())
+            line = std::move(region_line);
+        else
+            line.insert(insert_pos[i], std::make_move_iterator(region_line.begin()),
+                        std::make_move_iterator(region_line.end()));
     }
     display_buffer.compute_range();
 }
 
+// returns coord updated so that it points to the same buffer content
+// once change is applied, coords inside erased text go to its beginning.
+static BufferCoord update_coord(BufferCoord coord, const Buffer::Change& change)
+{
+    const BufferCoord& begin = change.begin;
+    const BufferCoord& end = change.end;
+    if (change.type == Buffer::Change::Insert)
+    {
+        if (coord < begin)
+            return coord;
+        if (coord.line == begin.line)
+            coord.column = end.column + coord.column - begin.column;
+        coord.line += end.line - begin.line;
+        return coord;
+    }
+
+    if (coord <= begin)
+        return coord;
+    if (coord < end)
+        return begin;
+    if (coord.line == end.line)
+        coord.column = begin.column + coord.column - end.column;
+    coord.line -= end.line - begin.line;
+    return coord;
+}
+
+// computes the range of the buffer modified by changes: the content before
+// first is untouched, and the content after last was only moved around.
+static void compute_modified_range(memoryview<Buffer::Change> changes,
+                                   BufferCoord& first, BufferCoord& last)
+{
+    kak_assert(not changes.empty());
+    first = last = changes[0].begin;
+    for (auto& change : changes)
+    {
+        first = std::min(first, change.begin);
+        last = std::max(update_coord(last, change),
+                        change.type == Buffer::Change::Insert ? change.end
+                                                              : change.begin);
+    }
+}
+
 typedef std::unordered_map<size_t, const ColorPair*> ColorSpec;
 
 class RegexColorizer
@@ -152,65 +182,291 @@ public:
     RegexColorizer(Regex regex, ColorSpec colors)
         : m_regex(std::move(regex)), m_colors(std::move(colors))
     {
+        if (not m_regex.empty())
+            m_line_regex = LineRegex{m_regex.str()};
     }
 
     void operator()(const Context& context, DisplayBuffer& display_buffer)
     {
-        auto& cache = update_cache_ifn(context.buffer(), display_buffer.range());
-        for (auto& match : cache.m_matches)
+        const Buffer& buffer = context.buffer();
+        MatchesCache* cache_ptr = nullptr;
+        try
         {
-            for (size_t n = 0; n < match.size(); ++n)
-            {
-                auto col_it = m_colors.find(n);
-                if (col_it == m_colors.end())
-                    continue;
+            cache_ptr = &update_cache_ifn(buffer, display_buffer.range());
+        }
+        catch (runtime_error& err)
+        {
+            // do not match again until the buffer or the range changes
+            write_debug("regex highlighter: "_str + err.what());
+            MatchesCache& cache = m_caches[buffer];
+            cache.m_matches.clear();
+            cache.m_timestamp = buffer.timestamp();
+            return;
+        }
+        auto& cache = *cache_ptr;
+        const size_t capture_count = cache.m_matches.empty() ?
+            0 : cache.m_matches.front().size();
+        for (size_t n = 0; n < capture_count; ++n)
+        {
+            auto col_it = m_colors.find(n);
+            if (col_it == m_colors.end())
+                continue;
 
-                highlight_range(display_buffer, match[n].first, match[n].second, true,
-                                [&](DisplayAtom& atom) { atom.colors = *col_it->second; });
+            m_ranges.clear();
+            for (auto& match : cache.m_matches)
+            {
+                if (n < match.size())
+                    m_ranges.push_back(match[n]);
+            }
+            auto apply_colors = [&](DisplayAtom& atom, size_t)
+                                { atom.colors = *col_it->second; };
+            // matches do not overlap, but captures can when using
+            // lookarounds, apply them one by one so that the last one wins.
+            if (sorted_and_disjoint(m_ranges))
+                highlight_ranges(display_buffer, m_ranges, true, apply_colors);
+            else
+            {
+                for (auto& range : m_ranges)
+                    highlight_ranges(display_buffer, range, true, apply_colors);
             }
         }
     }
 
 private:
+    using Match = std::vector<std::pair<BufferCoord, BufferCoord>>;
     struct MatchesCache
     {
-        BufferRange m_range;
-        size_t      m_timestamp;
-        std::vector<std::vector<std::pair<BufferCoord, BufferCoord>>> m_matches;
+        BufferRange        m_range;
+        size_t             m_timestamp = -1;
+        std::vector<Match> m_matches;
     };
-    std::unordered_map<const Buffer*, MatchesCache> m_caches;
+    BufferCache<MatchesCache> m_caches;
 
     Regex     m_regex;
+    LineRegex m_line_regex;
     ColorSpec m_colors;
 
+    // kept between calls so that its storage is reused
+    std::vector<BufferRange> m_ranges;
+
+    bool use_line_regex() const
+    {
+        return not m_line_regex.empty() and m_line_regex.is_line_local();
+    }
+
     MatchesCache& update_cache_ifn(const Buffer& buffer, const BufferRange& range)
     {
-        MatchesCache& cache = m_caches[&buffer];
+        MatchesCache& cache = m_caches[buffer];
 
         if (buffer.timestamp() == cache.m_timestamp and
             range.first >= cache.m_range.first and
             range.second <= cache.m_range.second)
            return cache;
 
+        if (cache.m_timestamp < buffer.timestamp() and
+            update_modified_lines(buffer, range, cache))
+            return cache;
+
+        // the cache ends at the beginning of a line, display ranges showing
+        // the last line end at {line_count, 0} as well.
+        Profiler::Section section{"rescan"};
         cache.m_range.first  = buffer.clamp({range.first.line - 10, 0});
-        cache.m_range.second = buffer.next(buffer.clamp({range.second.line + 10, INT_MAX}));
+        cache.m_range.second = {std::min(range.second.line + 11, buffer.line_count()), 0};
         cache.m_timestamp = buffer.timestamp();
 
         cache.m_matches.clear();
-        RegexIterator re_it{buffer.iterator_at(cache.m_range.first),
-                            buffer.iterator_at(cache.m_range.second), m_regex};
-        RegexIterator re_end;
-        for (; re_it != re_end; ++re_it)
+        if (use_line_regex())
+            match_lines(buffer, cache.m_range, cache.m_range.first.line,
+                        cache.m_range.second.line, cache.m_matches);
+        else
+            match_range(buffer, cache.m_range, cache.m_range.first,
+                        {}, {}, cache.m_matches);
+        return cache;
+    }
+
+    // update the cache to the current buffer state, only matching again
+    // around the modified lines. returns false if the cache cannot be
+    // reused for range.
+    bool update_modified_lines(const Buffer& buffer, const BufferRange& range,
+                               MatchesCache& cache)
+    {
+        auto changes_ifp = buffer.changes_since(cache.m_timestamp);
+        if (not changes_ifp)
+            return false;
+        auto changes = *changes_ifp;
+        BufferRange cache_range = cache.m_range;
+        for (auto& change : changes)
         {
-            cache.m_matches.emplace_back();
-            auto& match = cache.m_matches.back();
-            for (auto& sub : *re_it)
-                match.emplace_back(sub.first.coord(), sub.second.coord());
+            cache_range.first = update_coord(cache_range.first, change);
+            cache_range.second = update_coord(cache_range.second, change);
+        }
+        if (range.first < cache_range.first or range.second > cache_range.second)
+            return false;
+
+        cache.m_range = cache_range;
+        cache.m_timestamp = buffer.timestamp();
+        if (changes.empty())
+            return true;
+
+        BufferCoord first, last;
+        compute_modified_range(changes, first, last);
+
+        // matches before the first modified line are still valid, the
+        // ones starting after the modified text are moved to their new
+        // coordinates.
+        std::vector<Match> matches;
+        std::vector<Match> moved_matches;
+        for (auto& match : cache.m_matches)
+        {
+            if (match[0].first.line < first.line and
+                (use_line_regex() or match[0].second.line < first.line))
+            {
+                matches.push_back(std::move(match));
+                continue;
+            }
+            for (auto& sub : match)
+            {
+                for (auto& change : changes)
+                {
+                    sub.first = update_coord(sub.first, change);
+                    sub.second = update_coord(sub.second, change);
+                }
+            }
+            if (match[0].first > last)
+                moved_matches.push_back(std::move(match));
+        }
+
+        if (use_line_regex())
+        {
+            // line local matches do not depend on other lines
+            auto it = std::find_if(moved_matches.begin(), moved_matches.end(),
+                                   [&](const Match& match)
+                                   { return match[0].first.line > last.line; });
+            match_lines(buffer, cache_range, std::max(first.line, cache_range.first.line),
+                        std::min(last.line + 1, cache_range.second.line), matches);
+            std::move(it, moved_matches.end(), std::back_inserter(matches));
+        }
+        else
+        {
+            // trailing empty matches are matched again, as the regex
+            // iterator needs to know about them to find the next one.
+            while (not matches.empty() and
+                   matches.back()[0].first == matches.back()[0].second)
+                matches.pop_back();
+            BufferCoord pos = matches.empty() ? cache_range.first
+                                              : matches.back()[0].second;
+            match_range(buffer, cache_range, pos, last,
+                        std::move(moved_matches), matches);
+        }
+        cache.m_matches = std::move(matches);
+        return true;
+    }
+
+    // match the [begin, range.second) part of range, using regex iterator.
+    // once a match starting after resync_pos is found in old_matches, the
+    // following old matches are used instead of matching further.
+    void match_range(const Buffer& buffer, const BufferRange& range,
+                     BufferCoord begin, BufferCoord resync_pos,
+                     std::vector<Match> old_matches, std::vector<Match>& matches)
+    {
+        auto old_it = old_matches.begin();
+        RegexBudget budget{highlighter_budget};
+        try
+        {
+            auto flags = begin == range.first ? boost::match_default
+                       : boost::match_prev_avail | boost::match_not_bob;
+            RegexIterator re_it{{buffer.iterator_at(begin), budget},
+                                {buffer.iterator_at(range.second), budget},
+                                m_regex, flags};
+            RegexIterator re_end;
+            for (; re_it != re_end; ++re_it)
+            {
+                const auto& match_begin = (*re_it)[0].first.base().coord();
+                while (old_it != old_matches.end() and old_it->front().first < match_begin)
+                    ++old_it;
+                if (match_begin > resync_pos and old_it != old_matches.end() and
+                    old_it->front() == std::make_pair(match_begin, (*re_it)[0].second.base().coord()))
+                {
+                    std::move(old_it, old_matches.end(), std::back_inserter(matches));
+                    break;
+                }
+
+                matches.emplace_back();
+                auto& match = matches.back();
+                for (auto& sub : *re_it)
+                    match.emplace_back(sub.first.base().coord(), sub.second.base().coord());
+            }
+        }
+        catch (std::runtime_error& err)
+        {
+            // boost gave up on a too complex match, keep what was found
+            write_debug("regex highlighter: "_str + err.what());
+        }
+    }
+
+    // match each line content in [first_line, end_line) directly instead of
+    // going through BufferIterators, only valid for line local regexes.
+    void match_lines(const Buffer& buffer, const BufferRange& range,
+                     LineCount first_line, LineCount end_line,
+                     std::vector<Match>& matches)
+    {
+        const LineCount last_line = range.second.column == 0 ?
+            range.second.line - 1 : range.second.line;
+        end_line = std::min(end_line, last_line + 1);
+        for (LineCount line = first_line; line < end_line; ++line)
+        {
+            const char* begin = buffer[line].c_str();
+            const char* end = begin + (int)buffer[line].length();
+            auto coord = [&](const char* ptr) {
+                if (ptr == end and line + 1 < buffer.line_count())
+                    return BufferCoord{line + 1, 0};
+                return BufferCoord{line, (int)(ptr - begin)};
+            };
+            m_line_regex.for_each_match(begin, end,
+                [&](const LineRegex::Captures& captures) {
+                    // an empty match at end of line is the same as one at
+                    // the beginning of the next line.
+                    if (captures[0] == end and line != last_line)
+                        return;
+
+                    matches.emplace_back();
+                    auto& match = matches.back();
+                    for (size_t i = 0; i < captures.size(); i += 2)
+                    {
+                        if (not captures[i])
+                        {
+                            match.emplace_back(range.second, range.second);
+                            continue;
+                        }
+                        match.emplace_back(coord(captures[i]), coord(captures[i+1]));
+                    }
+                });
         }
-        return cache;
     }
 };
 
+static const Regex color_spec_ex(R"((\d+):(\w+(,\w+)?))");
+
+static bool is_color_spec(const String& param)
+{
+    return boost::regex_match(param.begin(), param.end(), color_spec_ex);
+}
+
+// parse a <capture>:<fgcolor>[,<bgcolor>] spec, capture_offset is added
+// to the capture id before inserting into colors.
+static void parse_color_spec(const String& spec, size_t capture_offset,
+                             ColorSpec& colors)
+{
+    boost::smatch res;
+    if (not boost::regex_match(spec.begin(), spec.end(), res, color_spec_ex))
+        throw runtime_error("wrong colorspec: '" + spec +
+                             "' expected <capture>:<fgcolor>[,<bgcolor>]");
+
+    int capture = str_to_int(res[1].str());
+    const ColorPair*& color = colors[capture_offset + capture];
+    color = &get_color(res[2].str());
+}
+
 HighlighterAndId colorize_regex_factory(HighlighterParameters params)
 {
     if (params.size() < 2)
@@ -218,19 +474,9 @@ HighlighterAndId colorize_regex_factory(HighlighterParameters params)
 
     try
     {
-        static Regex color_spec_ex(R"((\d+):(\w+(,\w+)?))");
         ColorSpec colors;
         for (auto it = params.begin() + 1;  it != params.end(); ++it)
-        {
-            boost::smatch res;
-            if (not boost::regex_match(it->begin(), it->end(), res, color_spec_ex))
-                throw runtime_error("wrong colorspec: '" + *it +
-                                     "' expected <capture>:<fgcolor>[,<bgcolor>]");
-
-            int capture = str_to_int(res[1].str());
-            const ColorPair*& color = colors[capture];
-            color = &get_color(res[2].str());
-        }
+            parse_color_spec(*it, 0, colors);
 
         String id = "colre'" + params[0] + "'";
 
@@ -245,6 +491,98 @@ HighlighterAndId colorize_regex_factory(HighlighterParameters params)
     }
 }
 
+// returns true if regex refers to a capture group by its number or name,
+// these references would point to other groups once regex is combined.
+static bool refers_to_groups(const String& regex)
+{
+    auto is_digit = [](char c) { return c >= '0' and c <= '9'; };
+    for (auto it = regex.begin(); it != regex.end(); ++it)
+    {
+        auto at = [&](int offset) { return regex.end() - it > offset ? *(it + offset) : 0; };
+        if (*it == '\\')
+        {
+            // \1 to \9, \g{n} and \k<name> backreferences
+            const char c = at(1);
+            if ((is_digit(c) and c != '0') or c == 'g' or c == 'k')
+                return true;
+            if (it + 1 != regex.end())
+                ++it; // skip the escaped char, which may be a backslash
+        }
+        else if (*it == '(' and at(1) == '?')
+        {
+            // (?P=name) backreferences, (?1), (?-1), (?&name), (?P>name)
+            // and (?R) recursions, (?(1)...) conditionals
+            const char c = at(2);
+            if ((c == 'P' and (at(3) == '=' or at(3) == '>')) or
+                is_digit(c) or ((c == '+' or c == '-') and is_digit(at(3))) or
+                c == '&' or c == 'R' or
+                (c == '(' and (is_digit(at(3)) or at(3) == '<' or
+                               at(3) == '\'' or at(3) == 'R')))
+                return true;
+        }
+    }
+    return false;
+}
+
+// multi_regex compiles all its regexes into a single alternation, so that
+// the displayed range is scanned only once whatever the regex count.
+// Each regex is wrapped in a capture group, and its own captures ids
+// are shifted so that they get dispatched to the right colors.
+HighlighterAndId colorize_multi_regex_factory(HighlighterParameters params)
+{
+    if (params.size() < 2)
+        throw runtime_error("wrong parameter count");
+
+    try
+    {
+        String id = "multire";
+        String combined;
+        ColorSpec colors;
+        size_t next_capture = 1;
+        size_t current_capture = 0;
+        const String* current_regex = nullptr;
+        bool has_colors = false;
+        for (auto& param : params)
+        {
+            if (current_regex and is_color_spec(param))
+            {
+                parse_color_spec(param, current_capture, colors);
+                has_colors = true;
+                continue;
+            }
+            if (current_regex and not has_colors)
+                throw runtime_error("no colorspec given for '" + *current_regex + "'");
+
+            if (refers_to_groups(param))
+                throw runtime_error("backreferences are not supported: '" + param + "'");
+
+            // check the regex on its own, and get its capture count
+            Regex ex{param.begin(), param.end()};
+
+            if (not combined.empty())
+                combined += "|";
+            combined += "(" + param + ")";
+            id += "'" + param + "'";
+
+            current_regex = &param;
+            current_capture = next_capture;
+            next_capture += 1 + ex.mark_count();
+            has_colors = false;
+        }
+        if (not has_colors)
+            throw runtime_error("no colorspec given for '" + *current_regex + "'");
+
+        Regex ex{combined.begin(), combined.end(), boost::regex::optimize};
+
+        return HighlighterAndId(id, RegexColorizer(std::move(ex),
+                                                   std::move(colors)));
+    }
+    catch (boost::regex_error& err)
+    {
+        throw runtime_error(String("regex error: ") + err.what());
+    }
+}
+
 template<typename RegexGetter>
 class DynamicRegexHighlighter
 {
@@ -311,6 +649,10 @@ void expand_tabulations(const Context& context, DisplayBuffer& display_buffer)
     auto& buffer = context.buffer();
     for (auto& line : display_buffer.lines())
     {
+        // display column of column_it, atoms being ordered it only needs
+        // to move forward from one tabulation to the next one.
+        BufferIterator column_it;
+        int column = 0;
         for (auto atom_it = line.begin(); atom_it != line.end(); ++atom_it)
         {
             if (atom_it->type() != DisplayAtom::BufferRange)
@@ -327,22 +669,23 @@ void expand_tabulations(const Context& context, DisplayBuffer& display_buffer)
                     if (it+1 != end)
                         atom_it = line.split(atom_it, (it+1).coord());
 
-                    int column = 0;
-                    for (auto line_it = buffer.iterator_at(it.coord().line);
-                         line_it != it; ++line_it)
+                    if (column_it == BufferIterator{} or it < column_it or
+                        column_it.coord().line != it.coord().line)
                     {
-                        kak_assert(*line_it != '\n');
-                        if (*line_it == '\t')
+                        column_it = buffer.iterator_at(it.coord().line);
+                        column = 0;
+                    }
+                    for (; column_it != it; ++column_it)
+                    {
+                        kak_assert(*column_it != '\n');
+                        if (*column_it == '\t')
                             column += tabstop - (column % tabstop);
-                        else
+                        else if (utf8::is_character_start(column_it))
                            ++column;
                     }
 
                     int count = tabstop - (column % tabstop);
-                    String padding;
-                    for (int i = 0; i < count; ++i)
-                        padding += ' ';
-                    atom_it->replace(padding);
+                    atom_it->replace(String{' ', CharCount{count}});
                     break;
                 }
             }
@@ -350,24 +693,44 @@ void expand_tabulations(const Context& context, DisplayBuffer& display_buffer)
     }
 }
 
-void show_line_numbers(const Context& context, DisplayBuffer& display_buffer)
+class LineNumbersHighlighter
 {
-    LineCount last_line = context.buffer().line_count();
-    int digit_count = 0;
-    for (LineCount c = last_line; c > 0; c /= 10)
-        ++digit_count;
-
-    char format[] = "%?d│";
-    format[1] = '0' + digit_count;
-    auto& colors = get_color("LineNumbers");
-    for (auto& line : display_buffer.lines())
+public:
+    void operator()(const Context& context, DisplayBuffer& display_buffer)
     {
-        char buffer[10];
-        snprintf(buffer, 10, format, (int)line.range().first.line + 1);
-        DisplayAtom atom{buffer};
-        atom.colors = colors;
-        line.insert(line.begin(), std::move(atom));
+        // color registry entries are updated in place, so this stays valid
+        if (not m_colors)
+            m_colors = &get_color("LineNumbers");
+
+        LineCount last_line = context.buffer().line_count();
+        int digit_count = 0;
+        for (LineCount c = last_line; c > 0; c /= 10)
+            ++digit_count;
+
+        // right aligned line number, followed by the separator. The text is
+        // formatted in place in m_text, whose storage is reused between
+        // calls, and is short enough for the atom copy not to allocate.
+        const char separator[] = "│";
+        m_text.resize(digit_count);
+        m_text += separator;
+        for (auto& line : display_buffer.lines())
+        {
+            int num = (int)line.range().first.line + 1;
+            for (int i = digit_count - 1; i >= 0; --i, num /= 10)
+                m_text[i] = num > 0 ? '0' + num % 10 : ' ';
+
+            line.prefix().insert(line.prefix().begin(), DisplayAtom{m_text, *m_colors});
+        }
     }
+
+private:
+    const ColorPair* m_colors = nullptr;
+    String           m_text;
+};
+
+HighlighterAndId line_numbers_factory(HighlighterParameters params)
+{
+    return {"number_lines", LineNumbersHighlighter{}};
 }
 
 void highlight_selections(const Context& context, DisplayBuffer& display_buffer)
@@ -390,6 +753,34 @@ void highlight_selections(const Context& context, DisplayBuffer& display_buffer)
     }
 }
 
+// the locale is set at startup, so iswprint results for the basic
+// multilingual plane can be computed once.
+static bool is_printable(Codepoint cp)
+{
+    static const std::bitset<0x10000> bmp_printable = [] {
+        std::bitset<0x10000> res;
+        for (Codepoint c = 0; c < res.size(); ++c)
+            res[c] = iswprint(c);
+        return res;
+    }();
+    return cp < bmp_printable.size() ? bmp_printable[cp] : iswprint(cp);
+}
+
+static String unprintable_to_string(Codepoint cp)
+{
+    char buffer[16];
+    char* pos = buffer + sizeof(buffer);
+    *--pos = 0;
+    do
+    {
+        *--pos = "0123456789abcdef"[cp & 0xF];
+        cp >>= 4;
+    } while (cp != 0);
+    *--pos = '+';
+    *--pos = 'U';
+    return pos;
+}
+
 void expand_unprintable(const Context& context, DisplayBuffer& display_buffer)
 {
     auto& buffer = context.buffer();
@@ -397,32 +788,116 @@ void expand_unprintable(const Context& context, DisplayBuffer& display_buffer)
     {
         for (auto atom_it = line.begin(); atom_it != line.end(); ++atom_it)
         {
-            if (atom_it->type() == DisplayAtom::BufferRange)
+            if (atom_it->type() != DisplayAtom::BufferRange)
+                continue;
+
+            // work directly on the line content, window atoms do not
+            // span multiple lines.
+            const BufferCoord atom_begin = atom_it->begin();
+            const BufferCoord atom_end = atom_it->end();
+            kak_assert(atom_end.line == atom_begin.line or
+                       (atom_end.line == atom_begin.line + 1 and atom_end.column == 0));
+            const String& content = buffer[atom_begin.line];
+            const char* line_begin = content.c_str();
+            const char* end = line_begin + (int)(atom_end.line == atom_begin.line ?
+                                                 atom_end.column : content.length());
+            for (const char* it = line_begin + (int)atom_begin.column; it < end; )
             {
-                using Utf8It = utf8::utf8_iterator<BufferIterator, utf8::InvalidBytePolicy::Pass>;
-                for (Utf8It it  = buffer.iterator_at(atom_it->begin()),
-                            end = buffer.iterator_at(atom_it->end()); it != end; ++it)
+                // fast path for printable ascii
+                const unsigned char c = *it;
+                if ((c >= 0x20 and c < 0x7F) or c == '\n')
                 {
-                    Codepoint cp = *it;
-                    if (cp != '\n' and not iswprint(cp))
-                    {
-                        std::ostringstream oss;
-                        oss << "U+" << std::hex << cp;
-                        String str = oss.str();
-                        if (it.base().coord() != atom_it->begin())
-                            atom_it = ++line.split(atom_it, it.base().coord());
-                        if ((it+1).base().coord() != atom_it->end())
-                            atom_it = line.split(atom_it, (it+1).base().coord());
-                        atom_it->replace(str);
-                        atom_it->colors = { Colors::Red, Colors::Black };
-                        break;
-                    }
+                    ++it;
+                    continue;
+                }
+
+                // atoms are split on bytes, and may end inside a codepoint
+                Codepoint cp = utf8::codepoint<utf8::InvalidBytePolicy::Pass>(it);
+                auto next = std::min(utf8::next(it), end);
+                if (c >= 0x80 and is_printable(cp))
+                {
+                    it = next;
+                    continue;
                 }
+
+                const BufferCoord cp_begin{atom_begin.line, (int)(it - line_begin)};
+                const BufferCoord cp_end = next == end ?
+                    atom_end : BufferCoord{atom_begin.line, (int)(next - line_begin)};
+                if (cp_begin != atom_begin)
+                    atom_it = ++line.split(atom_it, cp_begin);
+                if (cp_end != atom_end)
+                    atom_it = line.split(atom_it, cp_end);
+                atom_it->replace(unprintable_to_string(cp));
+                atom_it->colors = { Colors::Red, Colors::Black };
+                break;
             }
         }
     }
 }
 
+class FlagLinesHighlighter
+{
+public:
+    FlagLinesHighlighter(String option_name, Color bg)
+        : m_option_name(std::move(option_name)), m_bg(bg) {}
+
+    void operator()(const Context& context, DisplayBuffer& display_buffer)
+    {
+        auto& lines_opt = context.options()[m_option_name];
+        auto& lines = lines_opt.get<std::vector<LineAndFlag>>();
+        const FlagIndex& index = update_index_ifn(context.buffer(), lines_opt.timestamp(), lines);
+
+        for (auto& line : display_buffer.lines())
+        {
+            int line_num = (int)line.range().first.line + 1;
+            auto it = index.lines.find(line_num);
+            const LineAndFlag* flag = it != index.lines.end() ? &lines[it->second] : nullptr;
+
+            // padded in m_content, whose storage is reused between lines
+            m_content.clear();
+            if (flag)
+                m_content += std::get<2>(*flag);
+            m_content.append((int)(index.width - m_content.char_length()), ' ');
+            DisplayAtom atom{m_content};
+            atom.colors = { flag ? std::get<1>(*flag) : Colors::Default , m_bg };
+            line.prefix().insert(line.prefix().begin(), std::move(atom));
+        }
+    }
+
+private:
+    String m_option_name;
+    Color  m_bg;
+    String m_content;
+
+    // index of the first flag of each line in the option value, for the
+    // option value of each buffer.
+    struct FlagIndex
+    {
+        size_t                          option_timestamp = -1;
+        std::unordered_map<int, size_t> lines;
+        CharCount                       width = 0;
+    };
+    BufferCache<FlagIndex> m_indexes;
+
+    const FlagIndex& update_index_ifn(const Buffer& buffer, size_t option_timestamp,
+                                      const std::vector<LineAndFlag>& lines)
+    {
+        FlagIndex& index = m_indexes[buffer];
+        if (index.option_timestamp == option_timestamp)
+            return index;
+
+        index.option_timestamp = option_timestamp;
+        index.lines.clear();
+        index.width = 0;
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            index.lines.emplace((int)std::get<0>(lines[i]), i);
+            index.width = std::max(index.width, std::get<2>(lines[i]).char_length());
+        }
+        return index;
+    }
+};
+
 HighlighterAndId flag_lines_factory(HighlighterParameters params)
 {
     if (params.size() != 2)
@@ -434,52 +909,61 @@ HighlighterAndId flag_lines_factory(HighlighterParameters params)
     // throw if wrong option type
     GlobalOptions::instance()[option_name].get<std::vector<LineAndFlag>>();
 
-    return {"hlflags_" + params[1],
-            [=](const Context& context, DisplayBuffer& display_buffer)
-            {
-                auto& lines_opt = context.options()[option_name];
-                auto& lines = lines_opt.get<std::vector<LineAndFlag>>();
-
-                CharCount width = 0;
-                for (auto& l : lines)
-                     width = std::max(width, std::get<2>(l).char_length());
-                const String empty{' ', width};
-                for (auto& line : display_buffer.lines())
-                {
-                    int line_num = (int)line.range().first.line + 1;
-                    auto it = find_if(lines,
-                                      [&](const LineAndFlag& l)
-                                      { return std::get<0>(l) == line_num; });
-                    String content = it != lines.end() ? std::get<2>(*it) : empty;
-                    content += String(' ', width - content.char_length());
-                    DisplayAtom atom{std::move(content)};
-                    atom.colors = { it != lines.end() ? std::get<1>(*it) : Colors::Default , bg };
-                    line.insert(line.begin(), std::move(atom));
-                }
-            }};
+    return {"hlflags_" + params[1], FlagLinesHighlighter{option_name, bg}};
+}
+
+HighlighterAndId highlighter_group_factory(HighlighterParameters params)
+{
+    if (params.size() != 1)
+        throw runtime_error("wrong parameter count");
+
+    return HighlighterAndId(params[0], HighlighterGroup());
 }
 
-template<void (*highlighter_func)(const Context&, DisplayBuffer&)>
-class SimpleHighlighterFactory
+// reference to a defined highlighter group, the group is only looked up
+// again when the defined highlighters were modified.
+class DefinedGroupReference
 {
 public:
-    SimpleHighlighterFactory(const String& id) : m_id(id) {}
+    DefinedGroupReference(String name) : m_name(std::move(name)) {}
 
-    HighlighterAndId operator()(HighlighterParameters params) const
+    HighlighterGroup& group() const
     {
-        return HighlighterAndId(m_id, HighlighterFunc(highlighter_func));
+        auto& defined = DefinedHighlighters::instance();
+        if (m_generation != defined.generation())
+        {
+            m_group = &defined.get_group(m_name, '/');
+            m_generation = defined.generation();
+        }
+        return *m_group;
     }
+
+    DefinedGroupState& group_state() const
+    {
+        return DefinedHighlighters::instance().group_state(group());
+    }
+
+    const String& name() const { return m_name; }
+
 private:
-    String m_id;
+    String m_name;
+    mutable HighlighterGroup* m_group = nullptr;
+    mutable size_t            m_generation = -1;
 };
 
-HighlighterAndId highlighter_group_factory(HighlighterParameters params)
+class HighlighterReference
 {
-    if (params.size() != 1)
-        throw runtime_error("wrong parameter count");
+public:
+    HighlighterReference(String name) : m_ref(std::move(name)) {}
 
-    return HighlighterAndId(params[0], HighlighterGroup());
-}
+    void operator()(const Context& context, DisplayBuffer& display_buffer) const;
+
+    HighlighterGroup& group() const { return m_ref.group(); }
+    DefinedGroupState& group_state() const { return m_ref.group_state(); }
+
+private:
+    DefinedGroupReference m_ref;
+};
 
 HighlighterAndId reference_factory(HighlighterParameters params)
 {
@@ -491,11 +975,178 @@ HighlighterAndId reference_factory(HighlighterParameters params)
     // throw if not found
     DefinedHighlighters::instance().get_group(name, '/');
 
-    return HighlighterAndId(name,
-                            [name](const Context& context, DisplayBuffer& display_buffer)
-                            { DefinedHighlighters::instance().get_group(name, '/')(context, display_buffer); });
+    return HighlighterAndId(name, HighlighterReference{name});
 }
 
+static bool only_colors_buffer(const HighlighterFunc& highlighter);
+
+// colors of the atoms no highlighter colored, so that an explicit
+// default color is still applied over the window colors.
+static const ColorPair unset_colors{ Color{(Colors)-1}, Color{(Colors)-1} };
+
+// run highlighter on a display buffer containing only the lines of
+// display_buffer, and append the colored ranges to ranges and their colors
+// to colors. The colors applied by previous highlighters are not captured.
+template<typename Highlighter>
+static void capture_colors(Highlighter& highlighter, const Context& context,
+                           const DisplayBuffer& display_buffer,
+                           std::vector<BufferRange>& ranges,
+                           std::vector<ColorPair>& colors)
+{
+    const Buffer& buffer = context.buffer();
+    DisplayBuffer lines_display;
+    auto& lines = lines_display.lines();
+    lines.reserve(display_buffer.lines().size());
+    for (auto& line : display_buffer.lines())
+    {
+        DisplayAtom atom{buffer, line.range().first, line.range().second};
+        atom.colors = unset_colors;
+        lines.emplace_back(AtomList{ std::move(atom) });
+    }
+    lines_display.compute_range();
+    highlighter(context, lines_display);
+
+    size_t atom_count = 0;
+    for (auto& line : lines)
+        atom_count += line.atoms().size();
+    ranges.reserve(ranges.size() + atom_count);
+    colors.reserve(colors.size() + atom_count);
+
+    for (auto& line : lines)
+    {
+        for (auto& atom : line)
+        {
+            if (atom.type() != DisplayAtom::BufferRange or
+                atom.colors == unset_colors or atom.begin() == atom.end())
+                continue;
+            ranges.emplace_back(atom.begin(), atom.end());
+            colors.push_back(atom.colors);
+        }
+    }
+}
+
+// DeferredHighlighter wraps the highlighters which declare themselves slow
+// to update. Once an update took longer than the highlight_defer_threshold
+// option, the colors applied by the highlighter are captured, and buffer
+// modifications only move them until the buffer stays unmodified for a
+// while, at which point the highlighter is run again. Highlighters which
+// do not only change colors are always run directly.
+class DeferredHighlighter
+{
+public:
+    DeferredHighlighter(HighlighterFunc func) : m_func(std::move(func)) {}
+
+    void operator()(const Context& context, DisplayBuffer& display_buffer)
+    {
+        const int threshold = context.options()["highlight_defer_threshold"].get<int>();
+        if (threshold < 0 or not only_colors_buffer(m_func))
+            return m_func(context, display_buffer);
+
+        const Buffer& buffer = context.buffer();
+        State& state = m_states[buffer];
+        const auto& range = display_buffer.range();
+        if (state.slow and move_colors_ifn(buffer, state) and
+            Clock::now() < state.idle_date and
+            range.first.line >= state.range.first.line and
+            range.second.line <= state.range.second.line)
+        {
+            apply_colors(display_buffer, state);
+            return;
+        }
+
+        auto start = Clock::now();
+        if (state.slow)
+        {
+            state.ranges.clear();
+            state.colors.clear();
+            capture_colors(m_func, context, display_buffer, state.ranges, state.colors);
+            state.range = range;
+            state.timestamp = buffer.timestamp();
+            apply_colors(display_buffer, state);
+        }
+        else
+            m_func(context, display_buffer);
+        // only measure runs which had to update for a buffer modification,
+        // the others just hit the highlighter caches.
+        if (state.run_timestamp != buffer.timestamp())
+            state.slow = Clock::now() - start > std::chrono::milliseconds{threshold};
+        state.run_timestamp = buffer.timestamp();
+        state.idle_date = TimePoint{};
+    }
+
+    const HighlighterFunc& func() const { return m_func; }
+
+private:
+    HighlighterFunc m_func;
+
+    struct State
+    {
+        bool   slow = false;
+        size_t run_timestamp = -1;
+
+        // captured colors, moved to the buffer state at timestamp
+        size_t                   timestamp = -1;
+        BufferRange              range;
+        std::vector<BufferRange> ranges;
+        std::vector<ColorPair>   colors;
+
+        // date after which the highlighter is run again, the timer
+        // triggers a redraw then.
+        TimePoint              idle_date;
+        std::shared_ptr<Timer> timer;
+    };
+    BufferCache<State> m_states;
+
+    // move the captured colors to the current buffer state, returns false
+    // if they cannot be.
+    static bool move_colors_ifn(const Buffer& buffer, State& state)
+    {
+        if (state.timestamp == buffer.timestamp())
+            return true;
+        auto changes_ifp = state.timestamp < buffer.timestamp() ?
+            buffer.changes_since(state.timestamp) : boost::none;
+        if (not changes_ifp)
+            return false;
+
+        for (auto& change : *changes_ifp)
+        {
+            state.range.first = update_coord(state.range.first, change);
+            state.range.second = update_coord(state.range.second, change);
+            for (auto& range : state.ranges)
+            {
+                range.first = update_coord(range.first, change);
+                range.second = update_coord(range.second, change);
+            }
+        }
+        state.timestamp = buffer.timestamp();
+
+        if (not state.timer)
+        {
+            // the timer only refers to the buffer by id, so that it does not
+            // depend on this highlighter or the buffer lifetime.
+            const size_t buffer_id = buffer.id();
+            state.timer = std::make_shared<Timer>(TimePoint::max(),
+                [buffer_id](Timer&) {
+                    for (auto& buffer : BufferManager::instance())
+                    {
+                        if (buffer->id() == buffer_id)
+                            ClientManager::instance().invalidate_buffer_windows(*buffer);
+                    }
+                });
+        }
+        state.idle_date = Clock::now() + std::chrono::milliseconds{100};
+        state.timer->set_next_date(state.idle_date);
+        return true;
+    }
+
+    static void apply_colors(DisplayBuffer& display_buffer, const State& state)
+    {
+        highlight_ranges(display_buffer, state.ranges, true,
+                         [&](DisplayAtom& atom, size_t index)
+                         { atom.colors = state.colors[index]; });
+    }
+};
+
 template<typename HighlightFunc>
 struct RegionHighlighter
 {
@@ -508,46 +1159,118 @@ public:
 
     void operator()(const Context& context, DisplayBuffer& display_buffer)
     {
-        auto& cache = update_cache_ifn(context.buffer());
-        for (auto& pair : cache.regions)
+        for (auto& pair : update_cache_ifn(context.buffer()))
             m_func(context, display_buffer, pair.first, pair.second);
     }
+
+    const HighlightFunc& func() const { return m_func; }
+
 private:
     Regex m_begin;
     Regex m_end;
     HighlightFunc m_func;
 
+    using Region = std::pair<BufferCoord, BufferCoord>;
     struct RegionCache
     {
         size_t timestamp = -1;
-        std::vector<std::pair<BufferCoord, BufferCoord>> regions;
+        std::vector<Region> regions;
     };
-    std::unordered_map<const Buffer*, RegionCache> m_cache;
+    BufferCache<RegionCache> m_cache;
 
-    RegionCache& update_cache_ifn(const Buffer& buffer)
+    const std::vector<Region>& update_cache_ifn(const Buffer& buffer)
     {
-        RegionCache& cache = m_cache[&buffer];
+        RegionCache& cache = m_cache[buffer];
         if (cache.timestamp == buffer.timestamp())
-            return cache;
+            return cache.regions;
 
-        cache.regions.clear();
+        try
+        {
+            scan(buffer, cache);
+        }
+        catch (runtime_error& err)
+        {
+            // do not scan again until the buffer is modified
+            write_debug("region highlighter: "_str + err.what());
+            cache.regions.clear();
+            cache.timestamp = buffer.timestamp();
+        }
+        return cache.regions;
+    }
 
-        boost::match_results<BufferIterator> results;
-        auto pos = buffer.begin();
-        auto end = buffer.end();
-        while (boost::regex_search(pos, end, results, m_begin))
+    void scan(const Buffer& buffer, RegionCache& cache)
+    {
+        std::vector<Region> old_regions;
+        BufferCoord first_modified, last_modified;
+        auto changes_ifp = cache.timestamp < buffer.timestamp() ?
+            buffer.changes_since(cache.timestamp) : boost::none;
+        if (changes_ifp)
         {
-            pos = results[0].first;
-            if (boost::regex_search(results[0].second, end, results, m_end))
+            auto changes = *changes_ifp;
+            if (changes.empty()) // only the timestamp changed
             {
-                cache.regions.emplace_back(pos.coord(), results[0].second.coord());
-                pos = results[0].second;
+                cache.timestamp = buffer.timestamp();
+                return;
             }
-            else
-                break;
+            compute_modified_range(changes, first_modified, last_modified);
+
+            // regions ending before the first modified line are still
+            // valid, the following ones are updated to the new buffer
+            // state so that rescanning can stop once it finds one again.
+            auto it = std::lower_bound(cache.regions.begin(), cache.regions.end(),
+                                       first_modified.line,
+                                       [](const Region& region, LineCount line)
+                                       { return region.second.line < line; });
+            for (auto old_it = it; old_it != cache.regions.end(); ++old_it)
+            {
+                Region region = *old_it;
+                for (auto& change : changes)
+                {
+                    region.first = update_coord(region.first, change);
+                    region.second = update_coord(region.second, change);
+                }
+                if (region.first >= last_modified)
+                    old_regions.push_back(region);
+            }
+            cache.regions.erase(it, cache.regions.end());
+        }
+        else
+            cache.regions.clear();
+
+        RegexBudget budget{highlighter_budget};
+        BudgetBufferIterator pos{cache.regions.empty() ? buffer.begin()
+                                 : buffer.iterator_at(cache.regions.back().second), budget};
+        BudgetBufferIterator end{buffer.end(), budget};
+        auto old_it = old_regions.begin();
+        boost::match_results<BudgetBufferIterator> results;
+        try
+        {
+            while (boost::regex_search(pos, end, results, m_begin))
+            {
+                pos = results[0].first;
+                if (boost::regex_search(results[0].second, end, results, m_end))
+                {
+                    Region region{pos.base().coord(), results[0].second.base().coord()};
+                    while (old_it != old_regions.end() and old_it->first < region.first)
+                        ++old_it;
+                    // scanning from here would give the same regions as before
+                    if (old_it != old_regions.end() and *old_it == region)
+                    {
+                        cache.regions.insert(cache.regions.end(), old_it, old_regions.end());
+                        break;
+                    }
+                    cache.regions.push_back(region);
+                    pos = results[0].second;
+                }
+                else
+                    break;
+            }
+        }
+        catch (std::runtime_error& err)
+        {
+            write_debug("region highlighter: "_str + err.what());
         }
         cache.timestamp = buffer.timestamp();
-        return cache;
     }
 };
 
@@ -558,6 +1281,29 @@ make_region_highlighter(Regex begin, Regex end, HighlightFunc func)
     return RegionHighlighter<HighlightFunc>(std::move(begin), std::move(end), std::move(func));
 }
 
+struct RegionColorizer
+{
+    ColorPair colors;
+
+    void operator()(const Context&, DisplayBuffer& display_buffer,
+                    BufferCoord begin, BufferCoord end) const
+    {
+        highlight_range(display_buffer, begin, end, true,
+                        [this](DisplayAtom& atom) { atom.colors = colors; });
+    }
+};
+
+struct RegionReference
+{
+    DefinedGroupReference ref;
+
+    void operator()(const Context& context, DisplayBuffer& display_buffer,
+                    BufferCoord begin, BufferCoord end) const
+    {
+        apply_highlighter(context, display_buffer, begin, end, ref.group());
+    }
+};
+
 HighlighterAndId region_factory(HighlighterParameters params)
 {
     try
@@ -567,17 +1313,10 @@ HighlighterAndId region_factory(HighlighterParameters params)
 
         Regex begin{params[0], boost::regex::nosubs | boost::regex::optimize };
         Regex end{params[1], boost::regex::nosubs | boost::regex::optimize };
-        const ColorPair colors = get_color(params[2]);
-
-        auto func = [colors](const Context&, DisplayBuffer& display_buffer,
-                             BufferCoord begin, BufferCoord end)
-        {
-            highlight_range(display_buffer, begin, end, true,
-                            [&colors](DisplayAtom& atom) { atom.colors = colors; });
-        };
+        RegionColorizer func{get_color(params[2])};
 
         return HighlighterAndId("region(" + params[0] + "," + params[1] + ")",
-                                make_region_highlighter(std::move(begin), std::move(end), func));
+                                DeferredHighlighter{make_region_highlighter(std::move(begin), std::move(end), func)});
     }
     catch (boost::regex_error& err)
     {
@@ -595,29 +1334,506 @@ HighlighterAndId region_ref_factory(HighlighterParameters params)
         Regex begin{params[0], boost::regex::nosubs | boost::regex::optimize };
         Regex end{params[1], boost::regex::nosubs | boost::regex::optimize };
         const String& name = params[2];
+        RegionReference func{DefinedGroupReference{name}};
+
+        return HighlighterAndId("regionref(" + params[0] + "," + params[1] + "," + name + ")",
+                                DeferredHighlighter{make_region_highlighter(std::move(begin), std::move(end), func)});
+    }
+    catch (boost::regex_error& err)
+    {
+        throw runtime_error(String("regex error: ") + err.what());
+    }
+}
+
+// SyntaxHighlighter colors the buffer according to a state machine: in
+// each state, the leftmost match of the state rules is colored, and the
+// matching rule can push a new state, whose content gets the rule color
+// until a rule pops it.
+// The state stack at each line end is kept, so that after a modification
+// scanning resumes from the first modified line, and stops as soon as a
+// line ends in the same state as it did before the modification.
+class SyntaxHighlighter
+{
+public:
+    struct Rule
+    {
+        int       state;
+        Regex     regex;
+        int       push_state; // -1 if the rule does not push
+        bool      pop;
+        ColorPair colors;
+    };
+
+    SyntaxHighlighter(std::vector<Rule> rules)
+        : m_rules(std::move(rules))
+    {
+        // the initial stack only contains the first rule state
+        m_stacks.push_back({ -1 });
+        m_stack_ids.emplace(m_stacks.back(), 0);
+    }
+
+    void operator()(const Context& context, DisplayBuffer& display_buffer)
+    {
+        const Buffer& buffer = context.buffer();
+        if (m_stacks.size() > m_collect_threshold)
+            collect_stacks();
+        try
+        {
+            const auto& range = display_buffer.range();
+            DisplayedRanges displayed{ range.first.line, range.second.line };
+            RegexBudget budget{highlighter_budget};
+            LineStates& states = update_states_ifn(buffer, displayed, budget);
+
+            // lines scanned while updating the states are not scanned again
+            std::vector<BufferRange> ranges;
+            std::vector<const ColorPair*> colors;
+            bool scanned_added = false;
+            for (auto& display_line : display_buffer.lines())
+            {
+                LineCount line = display_line.range().first.line;
+                if (line >= displayed.scanned_begin and line < displayed.scanned_end)
+                {
+                    if (not scanned_added)
+                    {
+                        ranges.insert(ranges.end(), displayed.ranges.begin(),
+                                      displayed.ranges.end());
+                        colors.insert(colors.end(), displayed.colors.begin(),
+                                      displayed.colors.end());
+                        scanned_added = true;
+                    }
+                    continue;
+                }
+                size_t stack = line == 0 ? 0 : states.end_stacks[(int)line-1];
+                scan_line(buffer, line, stack, budget, &ranges, &colors);
+            }
+            highlight_ranges(display_buffer, ranges, true,
+                             [&](DisplayAtom& atom, size_t index)
+                             { atom.colors = *colors[index]; });
+        }
+        catch (std::runtime_error& err)
+        {
+            write_debug("syntax highlighter: "_str + err.what());
+        }
+        catch (runtime_error& err)
+        {
+            // the line states scanned so far are kept, the next redraw
+            // resumes from there.
+            write_debug("syntax highlighter: "_str + err.what());
+        }
+    }
+
+private:
+    std::vector<Rule> m_rules;
+
+    // state stacks are interned, a stack contains the index of the rules
+    // which pushed each state, -1 being the initial state.
+    using Stack = std::vector<int>;
+    std::vector<Stack>     m_stacks;
+    std::map<Stack, size_t> m_stack_ids;
+
+    // stacks are collected once they are twice as many as after the last
+    // collection, keeping the interning cost amortized.
+    enum { min_collect_threshold = 256 };
+    size_t m_collect_threshold = min_collect_threshold;
+
+    struct LineStates
+    {
+        size_t              timestamp = -1;
+        std::vector<size_t> end_stacks;
+
+        // end stacks of the lines following the last modification, as
+        // they were before it, old_first_line being the first of them.
+        std::vector<size_t> old_end_stacks;
+        LineCount           old_first_line = 0;
+    };
+    BufferCache<LineStates> m_states;
+
+    // colored ranges of the displayed lines scanned when updating states,
+    // which are the lines from scanned_begin to scanned_end.
+    struct DisplayedRanges
+    {
+        DisplayedRanges(LineCount first_line, LineCount last_line)
+            : first_line(first_line), last_line(last_line) {}
+
+        LineCount first_line;
+        LineCount last_line;
+        std::vector<BufferRange> ranges;
+        std::vector<const ColorPair*> colors;
+        LineCount scanned_begin = 0;
+        LineCount scanned_end = 0;
+    };
+
+    size_t intern(const Stack& stack)
+    {
+        auto it = m_stack_ids.find(stack);
+        if (it != m_stack_ids.end())
+            return it->second;
+        m_stacks.push_back(stack);
+        m_stack_ids.emplace(stack, m_stacks.size() - 1);
+        return m_stacks.size() - 1;
+    }
+
+    // drop the stacks no line state refers to, the initial stack is kept
+    void collect_stacks()
+    {
+        Profiler::Section section{"collect_stacks"};
+        std::vector<size_t> new_ids(m_stacks.size(), -1);
+        new_ids[0] = 0;
+        size_t count = 1;
+        auto remap = [&](std::vector<size_t>& stack_ids) {
+            for (auto& id : stack_ids)
+            {
+                if (new_ids[id] == (size_t)-1)
+                    new_ids[id] = count++;
+                id = new_ids[id];
+            }
+        };
+        for (auto& states : m_states)
+        {
+            remap(states.second.end_stacks);
+            remap(states.second.old_end_stacks);
+        }
+
+        std::vector<Stack> stacks(count);
+        for (size_t id = 0; id < m_stacks.size(); ++id)
+        {
+            if (new_ids[id] != (size_t)-1)
+                stacks[new_ids[id]] = std::move(m_stacks[id]);
+        }
+        m_stacks = std::move(stacks);
+        m_stack_ids.clear();
+        for (size_t id = 0; id < m_stacks.size(); ++id)
+            m_stack_ids.emplace(m_stacks[id], id);
+        m_collect_threshold = std::max<size_t>(min_collect_threshold, 2 * m_stacks.size());
+    }
 
-        auto func = [name](const Context& context, DisplayBuffer& display_buffer,
-                          BufferCoord begin, BufferCoord end)
+    int current_state(const Stack& stack) const
+    {
+        return stack.back() == -1 ? m_rules.front().state
+                                  : m_rules[stack.back()].push_state;
+    }
+
+    // scans a line starting with given stack, and returns the stack at its
+    // end. If ranges is not null, the colored ranges are appended to it.
+    size_t scan_line(const Buffer& buffer, LineCount line, size_t stack_id,
+                     const RegexBudget& budget,
+                     std::vector<BufferRange>* ranges,
+                     std::vector<const ColorPair*>* colors)
+    {
+        const String& content = buffer[line];
+        Stack stack = m_stacks[stack_id];
+
+        // leftmost match of each rule, as long as it does not start before
+        // the current position, searching again would give the same result.
+        struct Match
         {
-            HighlighterGroup& ref = DefinedHighlighters::instance().get_group(name, '/');
-            apply_highlighter(context, display_buffer, begin, end, ref);
+            bool searched = false;
+            bool found = false;
+            String::const_iterator begin, end;
         };
+        std::vector<Match> matches(m_rules.size());
+        using Iterator = BudgetIterator<String::const_iterator>;
+        boost::match_results<Iterator> results;
 
-        return HighlighterAndId("regionref(" + params[0] + "," + params[1] + "," + name + ")",
-                                make_region_highlighter(std::move(begin), std::move(end), func));
+        auto add_range = [&](ByteCount begin, ByteCount end, const ColorPair& color) {
+            if (ranges and begin != end)
+            {
+                BufferCoord end_coord = end == content.length() ? BufferCoord{line+1, 0}
+                                                                : BufferCoord{line, end};
+                ranges->emplace_back(BufferCoord{line, begin}, end_coord);
+                colors->push_back(&color);
+            }
+        };
+
+        auto pos = content.begin();
+        while (pos != content.end())
+        {
+            const int state = current_state(stack);
+            int best = -1;
+            for (size_t i = 0; i < m_rules.size(); ++i)
+            {
+                if (m_rules[i].state != state)
+                    continue;
+                Match& match = matches[i];
+                if (not match.searched or (match.found and match.begin < pos))
+                {
+                    auto flags = boost::match_not_null;
+                    if (pos != content.begin())
+                        flags |= boost::match_prev_avail;
+                    match.searched = true;
+                    match.found = boost::regex_search(Iterator{pos, budget},
+                                                      Iterator{content.end(), budget},
+                                                      results, m_rules[i].regex, flags);
+                    if (match.found)
+                    {
+                        match.begin = results[0].first.base();
+                        match.end = results[0].second.base();
+                    }
+                }
+                if (match.found and (best == -1 or match.begin < matches[best].begin))
+                    best = i;
+            }
+
+            auto content_end = best == -1 ? content.end() : matches[best].begin;
+            if (stack.back() != -1)
+                add_range(pos - content.begin(), content_end - content.begin(),
+                          m_rules[stack.back()].colors);
+            if (best == -1)
+                break;
+
+            const Rule& rule = m_rules[best];
+            pos = matches[best].end;
+            add_range(content_end - content.begin(), pos - content.begin(), rule.colors);
+            if (rule.pop and stack.size() > 1)
+                stack.pop_back();
+            if (rule.push_state != -1)
+                stack.push_back(best);
+        }
+        return intern(stack);
+    }
+
+    LineStates& update_states_ifn(const Buffer& buffer, DisplayedRanges& displayed,
+                                  const RegexBudget& budget)
+    {
+        LineStates& states = m_states[buffer];
+        if (states.timestamp != buffer.timestamp())
+        {
+            auto changes_ifp = states.timestamp < buffer.timestamp() ?
+                buffer.changes_since(states.timestamp) : boost::none;
+            auto changes = changes_ifp ? *changes_ifp : memoryview<Buffer::Change>{};
+            if (not changes.empty())
+            {
+                BufferCoord first_modified, last_modified;
+                compute_modified_range(changes, first_modified, last_modified);
+
+                LineCount line_offset = 0;
+                for (auto& change : changes)
+                {
+                    LineCount line_count = change.end.line - change.begin.line;
+                    line_offset += change.type == Buffer::Change::Insert ? line_count
+                                                                         : -line_count;
+                }
+
+                // lines after the modified ones are the same as before, their
+                // old end stack is kept to detect when scanning can stop. Old
+                // stacks waiting from a previous modification are dropped.
+                auto& end_stacks = states.end_stacks;
+                const LineCount first_old_line = last_modified.line + 1 - line_offset;
+                states.old_end_stacks.clear();
+                if (first_old_line < (int)end_stacks.size())
+                    states.old_end_stacks.assign(end_stacks.begin() + (int)first_old_line,
+                                                 end_stacks.end());
+                states.old_first_line = last_modified.line + 1;
+
+                end_stacks.resize(std::min<size_t>(end_stacks.size(),
+                                                   (int)first_modified.line));
+            }
+            else if (not changes_ifp)
+            {
+                states.end_stacks.clear();
+                states.old_end_stacks.clear();
+            }
+            states.timestamp = buffer.timestamp();
+        }
+
+        auto& end_stacks = states.end_stacks;
+        const LineCount end_line = std::min(displayed.last_line + 1, buffer.line_count());
+        while ((int)end_stacks.size() < (int)end_line)
+        {
+            const LineCount line = (int)end_stacks.size();
+            const bool is_displayed = line >= displayed.first_line;
+            if (is_displayed and displayed.scanned_begin == displayed.scanned_end)
+                displayed.scanned_begin = line;
+            size_t stack = scan_line(buffer, line, line == 0 ? 0 : end_stacks.back(),
+                                     budget, is_displayed ? &displayed.ranges : nullptr,
+                                     is_displayed ? &displayed.colors : nullptr);
+            end_stacks.push_back(stack);
+            if (is_displayed)
+                displayed.scanned_end = line + 1;
+
+            const LineCount old_index = line - states.old_first_line;
+            if (old_index >= 0 and old_index < (int)states.old_end_stacks.size())
+            {
+                // the following lines are the same and start in the same
+                // state as before, so they end in the same state as well.
+                if (states.old_end_stacks[(int)old_index] == stack)
+                {
+                    end_stacks.insert(end_stacks.end(),
+                                      states.old_end_stacks.begin() + (int)old_index + 1,
+                                      states.old_end_stacks.end());
+                    states.old_end_stacks.clear();
+                }
+            }
+            else if (old_index >= (int)states.old_end_stacks.size())
+                states.old_end_stacks.clear();
+        }
+        return states;
+    }
+};
+
+HighlighterAndId syntax_factory(HighlighterParameters params)
+{
+    if (params.size() < 5 or (params.size() - 1) % 4 != 0)
+        throw runtime_error("wrong parameter count");
+
+    std::vector<String> state_names;
+    auto state_id = [&](const String& name) {
+        auto it = find(state_names, name);
+        if (it != state_names.end())
+            return int(it - state_names.begin());
+        state_names.push_back(name);
+        return int(state_names.size() - 1);
+    };
+
+    std::vector<SyntaxHighlighter::Rule> rules;
+    try
+    {
+        for (size_t i = 1; i < params.size(); i += 4)
+        {
+            const String& action = params[i+2];
+            SyntaxHighlighter::Rule rule{ state_id(params[i]),
+                                          Regex{params[i+1], boost::regex::nosubs | boost::regex::optimize},
+                                          -1, false, get_color(params[i+3]) };
+            if (action.substr(0, 5_byte) == "push:")
+                rule.push_state = state_id(action.substr(5_byte));
+            else if (action == "pop")
+                rule.pop = true;
+            else if (action != "none")
+                throw runtime_error("unknown action '" + action + "'");
+            rules.push_back(std::move(rule));
+        }
     }
     catch (boost::regex_error& err)
     {
         throw runtime_error(String("regex error: ") + err.what());
     }
+
+    return HighlighterAndId("syntax_" + params[0],
+                            DeferredHighlighter{SyntaxHighlighter{std::move(rules)}});
+}
+
+static bool only_colors_buffer(const HighlighterGroup& group)
+{
+    return std::all_of(group.begin(), group.end(),
+                       [](const HighlighterAndId& highlighter)
+                       { return only_colors_buffer(highlighter.second); });
+}
+
+// colors applied by a highlighter group to some lines of a buffer, shared
+// between the windows displaying these lines during a redraw.
+struct SharedColors
+{
+    std::vector<BufferRange> ranges;
+    std::vector<ColorPair>   colors;
+};
+
+struct DefinedGroupState
+{
+    DefinedGroupState(const HighlighterGroup& group)
+        : only_colors(only_colors_buffer(group)) {}
+
+    const bool only_colors;
+
+    // highlighters state may change between redraws, only share during one
+    using Key = std::tuple<size_t, size_t, std::vector<BufferRange>>;
+    size_t                      redraw_count = -1;
+    std::map<Key, SharedColors> shared_colors;
+};
+
+// returns true if the highlighter output only depends on the buffer
+// content and only consists in color changes, so that it is the same
+// in every window displaying the same lines of a buffer.
+static bool only_colors_buffer(const HighlighterFunc& highlighter)
+{
+    if (highlighter.target<RegexColorizer>() or
+        highlighter.target<RegionHighlighter<RegionColorizer>>() or
+        highlighter.target<SyntaxHighlighter>())
+        return true;
+    if (auto group = highlighter.target<HighlighterGroup>())
+        return only_colors_buffer(*group);
+    if (auto deferred = highlighter.target<DeferredHighlighter>())
+        return only_colors_buffer(deferred->func());
+    if (auto ref = highlighter.target<HighlighterReference>())
+        return ref->group_state().only_colors;
+    if (auto region_ref = highlighter.target<RegionHighlighter<RegionReference>>())
+        return region_ref->func().ref.group_state().only_colors;
+    return false;
+}
+
+DefinedHighlighters::DefinedHighlighters() = default;
+DefinedHighlighters::~DefinedHighlighters() = default;
+
+void DefinedHighlighters::notify_modified()
+{
+    ++m_generation;
+    m_group_states.clear();
+}
+
+DefinedGroupState& DefinedHighlighters::group_state(HighlighterGroup& group)
+{
+    auto it = m_group_states.find(&group);
+    if (it != m_group_states.end())
+        return *it->second;
+
+    // computing the state may look up the state of referenced groups
+    std::unique_ptr<DefinedGroupState> state{new DefinedGroupState{group}};
+    return *(m_group_states[&group] = std::move(state));
+}
+
+static SharedColors& get_shared_colors(HighlighterGroup& group,
+                                       DefinedGroupState& state,
+                                       const Context& context,
+                                       const DisplayBuffer& display_buffer)
+{
+    const size_t redraw_count = ClientManager::instance().redraw_count();
+    if (state.redraw_count != redraw_count)
+    {
+        state.shared_colors.clear();
+        state.redraw_count = redraw_count;
+    }
+
+    const Buffer& buffer = context.buffer();
+    std::vector<BufferRange> line_ranges;
+    line_ranges.reserve(display_buffer.lines().size());
+    for (auto& line : display_buffer.lines())
+        line_ranges.push_back(line.range());
+
+    DefinedGroupState::Key key{buffer.id(), buffer.timestamp(), line_ranges};
+    auto it = state.shared_colors.find(key);
+    if (it != state.shared_colors.end())
+        return it->second;
+
+    // the captured colors are inserted once complete, as the group may
+    // contain references which get their shared colors while it is being
+    // highlighted.
+    SharedColors colors;
+    capture_colors(group, context, display_buffer, colors.ranges, colors.colors);
+    return state.shared_colors[std::move(key)] = std::move(colors);
+}
+
+void HighlighterReference::operator()(const Context& context,
+                                      DisplayBuffer& display_buffer) const
+{
+    // sharing only pays off when other windows display the same lines
+    HighlighterGroup& group = m_ref.group();
+    DefinedGroupState& state = m_ref.group_state();
+    if (not ClientManager::has_instance() or not state.only_colors or
+        ClientManager::instance().buffer_window_count(context.buffer()) < 2)
+        return group(context, display_buffer);
+
+    const SharedColors& shared = get_shared_colors(group, state, context, display_buffer);
+    highlight_ranges(display_buffer, shared.ranges, true,
+                     [&](DisplayAtom& atom, size_t index)
+                     { atom.colors = shared.colors[index]; });
 }
 
 void register_highlighters()
 {
     HighlighterRegistry& registry = HighlighterRegistry::instance();
 
-    registry.register_func("number_lines", SimpleHighlighterFactory<show_line_numbers>("number_lines"));
+    registry.register_func("number_lines", line_numbers_factory);
     registry.register_func("regex", colorize_regex_factory);
+    registry.register_func("multi_regex", colorize_multi_regex_factory);
     registry.register_func("regex_option", highlight_regex_option_factory);
     registry.register_func("search", highlight_search_factory);
     registry.register_func("group", highlighter_group_factory);
@@ -625,6 +1841,7 @@ void register_highlighters()
     registry.register_func("ref", reference_factory);
     registry.register_func("region", region_factory);
     registry.register_func("region_ref", region_ref_factory);
+    registry.register_func("syntax", syntax_factory);
 }
 
 }
@@ -1,8 +1,11 @@
 #ifndef highlighters_hh_INCLUDED
 #define highlighters_hh_INCLUDED
 
+#include "assert.hh"
 #include "color.hh"
+#include "display_buffer.hh"
 #include "highlighter.hh"
+#include "memoryview.hh"
 
 namespace Kakoune
 {
@@ -11,6 +14,88 @@ void register_highlighters();
 
 using LineAndFlag = std::tuple<LineCount, Color, String>;
 
+// returns true if the non empty ranges are sorted and do not overlap
+inline bool sorted_and_disjoint(memoryview<BufferRange> ranges)
+{
+    BufferCoord last_end;
+    for (auto& range : ranges)
+    {
+        if (range.first == range.second)
+            continue;
+        if (range.first < last_end)
+            return false;
+        last_end = range.second;
+    }
+    return true;
+}
+
+// apply func to the atoms covering the given ranges, which must be sorted
+// and must not overlap, splitting atoms as needed. func is passed the atom
+// and the index of the range covering it. lines and atoms are walked only
+// once for the whole batch. A replaced atom, which cannot be split, is
+// passed to func for every range covering it, so that the last one wins.
+template<typename T>
+void highlight_ranges(DisplayBuffer& display_buffer,
+                      memoryview<BufferRange> ranges,
+                      bool skip_replaced, T func)
+{
+    kak_assert(sorted_and_disjoint(ranges));
+    auto range_it = ranges.begin();
+    auto skip_ranges_before = [&](BufferCoord coord) {
+        while (range_it != ranges.end() and
+               (range_it->second <= coord or range_it->first == range_it->second))
+            ++range_it;
+        return range_it != ranges.end();
+    };
+
+    if (not skip_ranges_before(display_buffer.range().first))
+        return;
+
+    for (auto& line : display_buffer.lines())
+    {
+        auto& range = line.range();
+        if (range.second <= range_it->first)
+            continue;
+
+        for (auto atom_it = line.begin(); atom_it != line.end(); ++atom_it)
+        {
+            bool is_replaced = atom_it->type() == DisplayAtom::ReplacedBufferRange;
+
+            if (not atom_it->has_buffer_range() or
+                (skip_replaced and is_replaced))
+                continue;
+
+            if (not skip_ranges_before(atom_it->begin()))
+                return;
+
+            if (is_replaced)
+            {
+                for (auto it = range_it; it != ranges.end() and
+                     it->first < atom_it->end(); ++it)
+                {
+                    if (it->first != it->second)
+                        func(*atom_it, it - ranges.begin());
+                }
+                continue;
+            }
+
+            const BufferCoord begin = range_it->first;
+            const BufferCoord end = range_it->second;
+            if (begin >= atom_it->end())
+                continue;
+
+            if (begin > atom_it->begin())
+                atom_it = ++line.split(atom_it, begin);
+
+            // the remaining part of the atom is handled on next iteration,
+            // against the following ranges
+            if (end < atom_it->end())
+                atom_it = line.split(atom_it, end);
+            func(*atom_it, range_it - ranges.begin());
+        }
+    }
+}
+
 }
 
 #endif // highlighters_hh_INCLUDED
@@ -1022,12 +1022,19 @@ private:
     void move(Type offset)
     {
         auto& selections = context().selections();
+        std::vector<BufferCoord> lasts;
         for (auto& sel : selections)
+            lasts.push_back(sel.last());
+        if (context().has_window())
+            lasts = context().window().offset_coords(lasts, offset);
+        else
         {
-            auto last = context().has_window() ? context().window().offset_coord(sel.last(), offset)
-                                               : context().buffer().offset_coord(sel.last(), offset);
-            sel.first() = sel.last()  = last;
+            for (auto& last : lasts)
+                last = context().buffer().offset_coord(last, offset);
         }
+
+        for (size_t i = 0; i < selections.size(); ++i)
+            selections[i].first() = selections[i].last() = lasts[i];
         selections.sort_and_merge_overlapping();
     }
 
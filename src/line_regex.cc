@@ -0,0 +1,771 @@
+#include "line_regex.hh"
+
+#include "assert.hh"
+
+#include <memory>
+
+namespace Kakoune
+{
+
+namespace
+{
+
+using Op = LineRegex::Op;
+using Assertion = LineRegex::Assertion;
+using CharClass = LineRegex::CharClass;
+using Instruction = LineRegex::Instruction;
+
+struct unsupported_pattern {};
+
+constexpr int max_program_size = 5000;
+constexpr int max_repeat = 100;
+constexpr int unbounded = -1;
+
+// boost line separators
+inline bool is_separator(char c)
+{
+    return c == '\n' or c == '\r' or c == '\f';
+}
+
+inline bool is_word_byte(char c)
+{
+    return (c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or
+           (c >= '0' and c <= '9') or c == '_';
+}
+
+struct Node
+{
+    enum Type { Class, Assert, Sequence, Alternation, Capture, Repeat };
+
+    Node(Type type, int value = 0) : type(type), value(value) {}
+
+    Type type;
+    int  value; // class index, assertion or capture index
+    int  min = 1;
+    int  max = 1;
+    bool greedy = true;
+    std::vector<std::unique_ptr<Node>> children;
+};
+
+using NodePtr = std::unique_ptr<Node>;
+
+bool can_be_empty(const Node& node)
+{
+    switch (node.type)
+    {
+        case Node::Class: return false;
+        case Node::Assert: return true;
+        case Node::Repeat: return node.min == 0 or can_be_empty(*node.children[0]);
+        case Node::Capture: return can_be_empty(*node.children[0]);
+        case Node::Sequence:
+            for (auto& child : node.children)
+            {
+                if (not can_be_empty(*child))
+                    return false;
+            }
+            return true;
+        case Node::Alternation:
+            for (auto& child : node.children)
+            {
+                if (can_be_empty(*child))
+                    return true;
+            }
+            return false;
+    }
+    return false;
+}
+
+class Parser
+{
+public:
+    Parser(const String& pattern, std::vector<CharClass>& classes)
+        : m_pos(pattern.c_str()), m_end(pattern.c_str() + (int)pattern.length()),
+          m_classes(classes) {}
+
+    NodePtr parse()
+    {
+        NodePtr res = parse_alternation();
+        if (m_pos != m_end)
+            throw unsupported_pattern{};
+        return res;
+    }
+
+    size_t mark_count() const { return m_mark_count; }
+
+private:
+    NodePtr parse_alternation()
+    {
+        NodePtr sequence = parse_sequence();
+        if (m_pos == m_end or *m_pos != '|')
+            return sequence;
+
+        NodePtr alternation{new Node{Node::Alternation}};
+        alternation->children.push_back(std::move(sequence));
+        while (m_pos != m_end and *m_pos == '|')
+        {
+            ++m_pos;
+            alternation->children.push_back(parse_sequence());
+        }
+        return alternation;
+    }
+
+    NodePtr parse_sequence()
+    {
+        NodePtr sequence{new Node{Node::Sequence}};
+        while (m_pos != m_end and *m_pos != '|' and *m_pos != ')')
+        {
+            NodePtr atom = parse_atom();
+            sequence->children.push_back(parse_quantifier(std::move(atom)));
+        }
+        return sequence;
+    }
+
+    NodePtr parse_atom()
+    {
+        const char c = *m_pos++;
+        switch (c)
+        {
+            case '(':
+            {
+                NodePtr res;
+                if (m_pos != m_end and *m_pos == '?')
+                {
+                    // only non capturing groups are supported
+                    if (m_pos + 1 == m_end or m_pos[1] != ':')
+                        throw unsupported_pattern{};
+                    m_pos += 2;
+                    res = parse_alternation();
+                }
+                else
+                {
+                    res.reset(new Node{Node::Capture, (int)++m_mark_count});
+                    res->children.push_back(parse_alternation());
+                }
+                if (m_pos == m_end or *m_pos++ != ')')
+                    throw unsupported_pattern{};
+                return res;
+            }
+            case '[': return parse_class();
+            case '.': return make_class(CharClass{}.set());
+            case '^': return NodePtr{new Node{Node::Assert, (int)Assertion::LineStart}};
+            case '$': return NodePtr{new Node{Node::Assert, (int)Assertion::LineEnd}};
+            case '\\': return parse_escape();
+            case '*': case '+': case '?': case '{': case ')':
+                throw unsupported_pattern{};
+            default:
+            {
+                CharClass cl;
+                cl.set((unsigned char)c);
+                return make_class(cl);
+            }
+        }
+    }
+
+    NodePtr parse_escape()
+    {
+        if (m_pos == m_end)
+            throw unsupported_pattern{};
+
+        const char c = *m_pos;
+        Assertion assertion;
+        switch (c)
+        {
+            case 'b': assertion = Assertion::WordBoundary; break;
+            case 'B': assertion = Assertion::NotWordBoundary; break;
+            case '<': assertion = Assertion::WordStart; break;
+            case '>': assertion = Assertion::WordEnd; break;
+            default:
+            {
+                CharClass cl;
+                parse_class_escape(cl);
+                return make_class(cl);
+            }
+        }
+        ++m_pos;
+        return NodePtr{new Node{Node::Assert, (int)assertion}};
+    }
+
+    // parse an escape sequence matching a single byte or a byte class
+    // adding matched bytes to cl, returns the byte if a single one matches
+    int parse_class_escape(CharClass& cl)
+    {
+        if (m_pos == m_end)
+            throw unsupported_pattern{};
+
+        const char c = *m_pos++;
+        auto add_if = [&](bool negate, bool (*pred)(unsigned char)) {
+            for (int i = 0; i < 256; ++i)
+            {
+                if (pred(i) != negate)
+                    cl.set(i);
+            }
+            return -1;
+        };
+        static const auto is_digit = [](unsigned char c) { return c >= '0' and c <= '9'; };
+        static const auto is_word  = [](unsigned char c) { return is_word_byte(c); };
+        static const auto is_space = [](unsigned char c) {
+            return c == ' ' or c == '\t' or c == '\n' or
+                   c == '\v' or c == '\f' or c == '\r';
+        };
+        static const auto is_hspace = [](unsigned char c) { return c == ' ' or c == '\t'; };
+
+        switch (c)
+        {
+            case 'w': return add_if(false, is_word);
+            case 'W': return add_if(true, is_word);
+            case 'd': return add_if(false, is_digit);
+            case 'D': return add_if(true, is_digit);
+            case 's': return add_if(false, is_space);
+            case 'S': return add_if(true, is_space);
+            case 'h': return add_if(false, is_hspace);
+            case 'H': return add_if(true, is_hspace);
+            case 'n': cl.set('\n'); return '\n';
+            case 't': cl.set('\t'); return '\t';
+            case 'r': cl.set('\r'); return '\r';
+            case 'f': cl.set('\f'); return '\f';
+            case 'a': cl.set('\a'); return '\a';
+            case 'e': cl.set(27); return 27;
+            case 'x':
+            {
+                auto hex_value = [](char c) {
+                    if (c >= '0' and c <= '9') return c - '0';
+                    if (c >= 'a' and c <= 'f') return c - 'a' + 10;
+                    if (c >= 'A' and c <= 'F') return c - 'A' + 10;
+                    throw unsupported_pattern{};
+                };
+                if (m_end - m_pos < 2)
+                    throw unsupported_pattern{};
+                int value = hex_value(m_pos[0]) * 16 + hex_value(m_pos[1]);
+                m_pos += 2;
+                cl.set(value);
+                return value;
+            }
+        }
+        // escaped punctuation matches itself, other escapes are
+        // backreferences or features we do not support.
+        if (is_word_byte(c) or (unsigned char)c >= 128 or c == '<' or c == '>' or
+            c == '`' or c == '\'')
+            throw unsupported_pattern{};
+        cl.set((unsigned char)c);
+        return (unsigned char)c;
+    }
+
+    NodePtr parse_class()
+    {
+        bool negated = false;
+        if (m_pos != m_end and *m_pos == '^')
+        {
+            negated = true;
+            ++m_pos;
+        }
+
+        CharClass cl;
+        bool first = true;
+        while (true)
+        {
+            if (m_pos == m_end)
+                throw unsupported_pattern{};
+            if (*m_pos == ']' and not first)
+            {
+                ++m_pos;
+                break;
+            }
+            first = false;
+
+            // [:alpha:] like constructs are not supported
+            if (*m_pos == '[' and m_pos + 1 != m_end and
+                (m_pos[1] == ':' or m_pos[1] == '.' or m_pos[1] == '='))
+                throw unsupported_pattern{};
+
+            int range_begin = parse_class_char(cl);
+            if (range_begin == -1 or m_end - m_pos < 2 or
+                *m_pos != '-' or m_pos[1] == ']')
+                continue;
+
+            ++m_pos;
+            int range_end = parse_class_char(cl);
+            if (range_end == -1 or range_end < range_begin)
+                throw unsupported_pattern{};
+            for (int i = range_begin; i <= range_end; ++i)
+                cl.set(i);
+        }
+        if (negated)
+            cl.flip();
+        return make_class(cl);
+    }
+
+    int parse_class_char(CharClass& cl)
+    {
+        const char c = *m_pos++;
+        if (c == '\\')
+        {
+            if (m_pos != m_end and *m_pos == 'b')
+                throw unsupported_pattern{};
+            return parse_class_escape(cl);
+        }
+        cl.set((unsigned char)c);
+        return (unsigned char)c;
+    }
+
+    NodePtr parse_quantifier(NodePtr atom)
+    {
+        if (m_pos == m_end)
+            return atom;
+
+        int min, max;
+        switch (*m_pos)
+        {
+            case '*': min = 0; max = unbounded; ++m_pos; break;
+            case '+': min = 1; max = unbounded; ++m_pos; break;
+            case '?': min = 0; max = 1; ++m_pos; break;
+            case '{':
+            {
+                ++m_pos;
+                min = parse_number();
+                max = min;
+                if (m_pos != m_end and *m_pos == ',')
+                {
+                    ++m_pos;
+                    max = (m_pos != m_end and *m_pos == '}') ? unbounded
+                                                              : parse_number();
+                }
+                if (m_pos == m_end or *m_pos++ != '}' or
+                    (max != unbounded and max < min))
+                    throw unsupported_pattern{};
+                break;
+            }
+            default:
+                return atom;
+        }
+        // boost gives peculiar results when repeating something that can
+        // match an empty string, as the pike vm cannot reproduce them,
+        // leave these to boost.
+        if (atom->type == Node::Assert or (max != 1 and can_be_empty(*atom)))
+            throw unsupported_pattern{};
+
+        NodePtr repeat{new Node{Node::Repeat}};
+        repeat->min = min;
+        repeat->max = max;
+        if (m_pos != m_end and *m_pos == '?')
+        {
+            repeat->greedy = false;
+            ++m_pos;
+        }
+        else if (m_pos != m_end and *m_pos == '+') // possessive
+            throw unsupported_pattern{};
+        repeat->children.push_back(std::move(atom));
+        return repeat;
+    }
+
+    int parse_number()
+    {
+        int res = 0;
+        const char* begin = m_pos;
+        while (m_pos != m_end and *m_pos >= '0' and *m_pos <= '9')
+        {
+            res = res * 10 + *m_pos++ - '0';
+            if (res > max_repeat)
+                throw unsupported_pattern{};
+        }
+        if (m_pos == begin)
+            throw unsupported_pattern{};
+        return res;
+    }
+
+    NodePtr make_class(const CharClass& cl)
+    {
+        m_classes.push_back(cl);
+        return NodePtr{new Node{Node::Class, (int)m_classes.size() - 1}};
+    }
+
+    const char* m_pos;
+    const char* m_end;
+    std::vector<CharClass>& m_classes;
+    size_t m_mark_count = 0;
+};
+
+class Compiler
+{
+public:
+    Compiler(std::vector<Instruction>& program) : m_program(program) {}
+
+    void compile(const Node& node)
+    {
+        switch (node.type)
+        {
+            case Node::Class:
+                push(Op::Consume, node.value);
+                break;
+            case Node::Assert:
+                push(Op::Assert, node.value);
+                break;
+            case Node::Sequence:
+                for (auto& child : node.children)
+                    compile(*child);
+                break;
+            case Node::Capture:
+                push(Op::Save, 2 * node.value);
+                compile(*node.children[0]);
+                push(Op::Save, 2 * node.value + 1);
+                break;
+            case Node::Alternation:
+            {
+                std::vector<int> jumps;
+                for (size_t i = 0; i < node.children.size(); ++i)
+                {
+                    int split = -1;
+                    if (i + 1 != node.children.size())
+                        split = push(Op::Split, size() + 1);
+                    compile(*node.children[i]);
+                    if (i + 1 != node.children.size())
+                    {
+                        jumps.push_back(push(Op::Jump));
+                        m_program[split].alt = size();
+                    }
+                }
+                for (auto jump : jumps)
+                    m_program[jump].arg = size();
+                break;
+            }
+            case Node::Repeat:
+                compile_repeat(node);
+                break;
+        }
+        if (size() > max_program_size)
+            throw unsupported_pattern{};
+    }
+
+private:
+    void compile_repeat(const Node& node)
+    {
+        const Node& child = *node.children[0];
+        for (int i = 0; i < node.min; ++i)
+            compile(child);
+
+        if (node.max == unbounded)
+        {
+            const int split = push(Op::Split);
+            compile(child);
+            push(Op::Jump, split);
+            set_split_targets(split, split + 1, size(), node.greedy);
+            return;
+        }
+
+        std::vector<int> splits;
+        for (int i = node.min; i < node.max; ++i)
+        {
+            splits.push_back(push(Op::Split));
+            compile(child);
+        }
+        for (auto split : splits)
+            set_split_targets(split, split + 1, size(), node.greedy);
+    }
+
+    void set_split_targets(int split, int body, int out, bool greedy)
+    {
+        m_program[split].arg = greedy ? body : out;
+        m_program[split].alt = greedy ? out : body;
+    }
+
+    int push(Op op, int arg = 0)
+    {
+        m_program.push_back({op, arg, 0});
+        return size() - 1;
+    }
+
+    int size() const { return (int)m_program.size(); }
+
+    std::vector<Instruction>& m_program;
+};
+
+// collect instructions reachable from pc without consuming any byte
+void epsilon_closure(const std::vector<Instruction>& program, int pc,
+                     std::vector<bool>& visited, std::vector<int>& result)
+{
+    if (visited[pc])
+        return;
+    visited[pc] = true;
+    auto& inst = program[pc];
+    switch (inst.op)
+    {
+        case Op::Jump: epsilon_closure(program, inst.arg, visited, result); break;
+        case Op::Split:
+            epsilon_closure(program, inst.arg, visited, result);
+            epsilon_closure(program, inst.alt, visited, result);
+            break;
+        case Op::Save: epsilon_closure(program, pc + 1, visited, result); break;
+        case Op::Assert:
+            result.push_back(pc);
+            epsilon_closure(program, pc + 1, visited, result);
+            break;
+        case Op::Consume:
+        case Op::Match:
+            result.push_back(pc);
+            break;
+    }
+}
+
+}
+
+LineRegex::LineRegex(const String& pattern)
+{
+    try
+    {
+        Parser parser{pattern, m_classes};
+        NodePtr root = parser.parse();
+        m_mark_count = parser.mark_count();
+
+        m_program.push_back({Op::Save, 0, 0});
+        Compiler{m_program}.compile(*root);
+        m_program.push_back({Op::Save, 1, 0});
+        m_program.push_back({Op::Match, 0, 0});
+    }
+    catch (unsupported_pattern&)
+    {
+        m_program.clear();
+        m_classes.clear();
+        m_mark_count = 0;
+        return;
+    }
+
+    const int size = (int)m_program.size();
+
+    // a match spans multiple lines only if something can be consumed
+    // or asserted after a newline
+    m_line_local = true;
+    for (int pc = 0; pc < size and m_line_local; ++pc)
+    {
+        auto& inst = m_program[pc];
+        // \B differs at line start depending on previous line availability
+        if (inst.op == Op::Assert and
+            inst.arg == (int)Assertion::NotWordBoundary)
+            m_line_local = false;
+        if (inst.op != Op::Consume or not m_classes[inst.arg].test('\n'))
+            continue;
+        std::vector<bool> visited(size, false);
+        std::vector<int> reachable;
+        epsilon_closure(m_program, pc + 1, visited, reachable);
+        for (auto next : reachable)
+        {
+            if (m_program[next].op != Op::Match)
+                m_line_local = false;
+        }
+    }
+
+    std::vector<bool> visited(size, false);
+    std::vector<int> reachable;
+    epsilon_closure(m_program, 0, visited, reachable);
+    m_use_first_bytes = true;
+    for (auto pc : reachable)
+    {
+        if (m_program[pc].op == Op::Match)
+            m_use_first_bytes = false;
+        else if (m_program[pc].op == Op::Consume)
+            m_first_bytes |= m_classes[m_program[pc].arg];
+    }
+}
+
+namespace
+{
+
+struct ThreadList
+{
+    void reset(size_t program_size, size_t capture_count)
+    {
+        this->capture_count = capture_count;
+        if (marks.size() < program_size)
+            marks.resize(program_size, 0);
+        if (captures.size() < program_size * capture_count)
+            captures.resize(program_size * capture_count);
+        clear();
+    }
+
+    void clear()
+    {
+        pcs.clear();
+        if (++generation == 0)
+        {
+            std::fill(marks.begin(), marks.end(), 0);
+            generation = 1;
+        }
+    }
+
+    bool mark(int pc)
+    {
+        if (marks[pc] == generation)
+            return false;
+        marks[pc] = generation;
+        return true;
+    }
+
+    void push(int pc, const LineRegex::Captures& caps)
+    {
+        std::copy(caps.begin(), caps.end(),
+                  captures.begin() + pcs.size() * capture_count);
+        pcs.push_back(pc);
+    }
+
+    const char* const* thread_captures(size_t index) const
+    {
+        return captures.data() + index * capture_count;
+    }
+
+    size_t capture_count = 0;
+    unsigned generation = 0;
+    std::vector<int> pcs;
+    std::vector<unsigned> marks;
+    std::vector<const char*> captures;
+};
+
+struct Matcher
+{
+    const std::vector<Instruction>& program;
+    const std::vector<CharClass>& classes;
+    const char* begin;
+    const char* end;
+
+    bool check(Assertion assertion, const char* pos) const
+    {
+        switch (assertion)
+        {
+            case Assertion::LineStart:
+                if (pos == begin)
+                    return true;
+                if (pos == end)
+                    return is_separator(pos[-1]);
+                return is_separator(pos[-1]) and
+                       not (pos[-1] == '\r' and *pos == '\n');
+            case Assertion::LineEnd:
+                if (pos == end)
+                    return true;
+                return is_separator(*pos) and
+                       (pos == begin or not (pos[-1] == '\r' and *pos == '\n'));
+            case Assertion::WordBoundary:
+            case Assertion::NotWordBoundary:
+            {
+                if (assertion == Assertion::NotWordBoundary and
+                    (pos == end or pos == begin))
+                    return false;
+                bool next = pos != end and is_word_byte(*pos);
+                bool prev = pos != begin and is_word_byte(pos[-1]);
+                return (next != prev) == (assertion == Assertion::WordBoundary);
+            }
+            case Assertion::WordStart:
+                return pos != end and is_word_byte(*pos) and
+                       (pos == begin or not is_word_byte(pos[-1]));
+            case Assertion::WordEnd:
+                return pos != begin and is_word_byte(pos[-1]) and
+                       (pos == end or not is_word_byte(*pos));
+        }
+        return false;
+    }
+
+    void add_thread(ThreadList& list, int pc, const char* pos,
+                    LineRegex::Captures& caps) const
+    {
+        if (not list.mark(pc))
+            return;
+
+        auto& inst = program[pc];
+        switch (inst.op)
+        {
+            case Op::Jump:
+                add_thread(list, inst.arg, pos, caps);
+                break;
+            case Op::Split:
+                add_thread(list, inst.arg, pos, caps);
+                add_thread(list, inst.alt, pos, caps);
+                break;
+            case Op::Save:
+            {
+                const char* saved = caps[inst.arg];
+                caps[inst.arg] = pos;
+                add_thread(list, pc + 1, pos, caps);
+                caps[inst.arg] = saved;
+                break;
+            }
+            case Op::Assert:
+                if (check((Assertion)inst.arg, pos))
+                    add_thread(list, pc + 1, pos, caps);
+                break;
+            case Op::Consume:
+            case Op::Match:
+                list.push(pc, caps);
+                break;
+        }
+    }
+};
+
+}
+
+bool LineRegex::search(const char* begin, const char* end, const char* pos,
+                       Captures& captures, bool not_initial_null) const
+{
+    kak_assert(begin <= pos and pos <= end);
+    if (empty())
+        return false;
+
+    const size_t capture_count = 2 * (m_mark_count + 1);
+    const size_t program_size = m_program.size();
+    // thread lists are reused between searches to avoid reallocating
+    // them for each match.
+    static ThreadList current, next;
+    current.reset(program_size, capture_count);
+    next.reset(program_size, capture_count);
+    static Captures caps;
+    caps.resize(capture_count);
+    Matcher matcher{m_program, m_classes, begin, end};
+
+    bool matched = false;
+    for (const char* sp = pos; ; ++sp)
+    {
+        if (not matched)
+        {
+            if (m_use_first_bytes and current.pcs.empty())
+            {
+                current.clear();
+                while (sp != end and not m_first_bytes.test((unsigned char)*sp))
+                    ++sp;
+                if (sp == end)
+                    break;
+            }
+            std::fill(caps.begin(), caps.end(), nullptr);
+            matcher.add_thread(current, 0, sp, caps);
+        }
+        if (current.pcs.empty())
+        {
+            if (matched or sp == end)
+                break;
+            current.clear();
+            continue;
+        }
+
+        next.clear();
+        for (size_t i = 0; i < current.pcs.size(); ++i)
+        {
+            auto& inst = m_program[current.pcs[i]];
+            const char* const* thread_caps = current.thread_captures(i);
+            if (inst.op == Op::Match)
+            {
+                if (not_initial_null and thread_caps[0] == pos and thread_caps[1] == pos)
+                    continue;
+                captures.assign(thread_caps, thread_caps + capture_count);
+                matched = true;
+                // lower priority threads are discarded
+                break;
+            }
+            kak_assert(inst.op == Op::Consume);
+            if (sp != end and m_classes[inst.arg].test((unsigned char)*sp))
+            {
+                caps.assign(thread_caps, thread_caps + capture_count);
+                matcher.add_thread(next, current.pcs[i] + 1, sp + 1, caps);
+            }
+        }
+        std::swap(current, next);
+        if (sp == end)
+            break;
+    }
+    return matched;
+}
+
+}
@@ -0,0 +1,92 @@
+#ifndef line_regex_hh_INCLUDED
+#define line_regex_hh_INCLUDED
+
+#include "string.hh"
+
+#include <bitset>
+#include <vector>
+
+namespace Kakoune
+{
+
+// LineRegex is a regex engine for the subset of the boost perl syntax
+// which does not need backtracking.
+//
+// The compiled program is simulated as a Thompson NFA (pike VM), so the
+// matching time is guaranteed linear in the subject length. It works on
+// raw char ranges, typically a buffer line content, and follows boost
+// leftmost first semantics.
+//
+// Patterns using unsupported features (backreferences, lookarounds,
+// modifiers...) produce an empty LineRegex, users are expected to fall
+// back to boost in that case.
+class LineRegex
+{
+public:
+    LineRegex() = default;
+    explicit LineRegex(const String& pattern);
+
+    bool empty() const { return m_program.empty(); }
+    size_t mark_count() const { return m_mark_count; }
+
+    // true if no match can span multiple lines, in which case matching
+    // line by line gives the same results as matching the whole text.
+    bool is_line_local() const { return m_line_local; }
+
+    // captures are stored as begin/end pairs, unmatched ones are nullptr
+    using Captures = std::vector<const char*>;
+
+    // search the first match in [pos, end), the [begin, pos) part is only
+    // used to evaluate assertions. if not_initial_null is set, an empty
+    // match at pos is not accepted.
+    bool search(const char* begin, const char* end, const char* pos,
+                Captures& captures, bool not_initial_null = false) const;
+
+    bool search(const char* begin, const char* end) const
+    {
+        Captures captures;
+        return search(begin, end, begin, captures);
+    }
+
+    // calls func(captures) for every match in [begin, end), iterating
+    // the same way boost::regex_iterator does.
+    template<typename Func>
+    void for_each_match(const char* begin, const char* end, Func func) const
+    {
+        Captures captures;
+        bool not_initial_null = false;
+        for (const char* pos = begin;
+             search(begin, end, pos, captures, not_initial_null);
+             pos = captures[1])
+        {
+            func(const_cast<const Captures&>(captures));
+            not_initial_null = captures[0] == captures[1];
+        }
+    }
+
+    enum class Op : char { Consume, Split, Jump, Save, Assert, Match };
+    enum class Assertion : char { LineStart, LineEnd, WordBoundary,
+                                  NotWordBoundary, WordStart, WordEnd };
+    using CharClass = std::bitset<256>;
+
+    struct Instruction
+    {
+        Op  op;
+        int arg; // class index, assertion, capture slot or jump target
+        int alt; // second target for splits
+    };
+
+private:
+    std::vector<Instruction> m_program;
+    std::vector<CharClass>   m_classes;
+    size_t                   m_mark_count = 0;
+    bool                     m_line_local = false;
+
+    // when no match can be empty, a match can only start on one of these
+    bool                     m_use_first_bytes = false;
+    CharClass                m_first_bytes;
+};
+
+}
+
+#endif // line_regex_hh_INCLUDED
@@ -15,6 +15,7 @@
 #include "option_manager.hh"
 #include "keymap_manager.hh"
 #include "parameters_parser.hh"
+#include "profiler.hh"
 #include "register_manager.hh"
 #include "remote.hh"
 #include "shell_manager.hh"
@@ -276,16 +277,17 @@ int kakoune(memoryview<String> params)
     RegisterManager     register_manager;
     HighlighterRegistry highlighter_registry;
     DefinedHighlighters defined_highlighters;
+    Profiler            profiler;
     ColorRegistry       color_registry;
     ClientManager       client_manager;
 
-    run_unit_tests();
-
     register_env_vars();
     register_registers();
     register_commands();
     register_highlighters();
 
+    run_unit_tests();
+
     write_debug("*** This is the debug buffer, where debug info will be written ***");
     write_debug("pid: " + to_string(getpid()));
 
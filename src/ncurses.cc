@@ -2,10 +2,11 @@
 
 #include "display_buffer.hh"
 #include "event_manager.hh"
+#include "regex_budget.hh"
 #include "register_manager.hh"
 #include "utf8_iterator.hh"
 
-#include <map>
+#include <unordered_map>
 
 #define NCURSES_OPAQUE 0
 #define NCURSES_INTERNALS
@@ -24,58 +25,49 @@ using std::max;
 
 struct NCursesWin : WINDOW {};
 
-static void set_attribute(int attribute, bool on)
-{
-    if (on)
-        attron(attribute);
-    else
-        attroff(attribute);
-}
+template<typename T> T sq(T x) { return x * x; }
 
-static bool operator<(Color lhs, Color rhs)
+// named colors index this table directly, rgb ones are hashed
+static uint32_t color_key(Color color)
 {
-    if (lhs.color == rhs.color and lhs.color == Colors::RGB)
-        return lhs.r == rhs.r ? (lhs.g == rhs.g ? lhs.b < rhs.b
-                                                : lhs.g < rhs.g)
-                              : lhs.r < rhs.r;
-    return lhs.color < rhs.color;
+    return (uint32_t)color.color << 24 | color.r << 16 | color.g << 8 | color.b;
 }
 
-template<typename T> T sq(T x) { return x * x; }
-
 static int nc_color(Color color)
 {
-    static std::map<Color, int> colors = {
-        { Colors::Default, -1 },
-        { Colors::Black,   COLOR_BLACK },
-        { Colors::Red,     COLOR_RED },
-        { Colors::Green,   COLOR_GREEN },
-        { Colors::Yellow,  COLOR_YELLOW },
-        { Colors::Blue,    COLOR_BLUE },
-        { Colors::Magenta, COLOR_MAGENTA },
-        { Colors::Cyan,    COLOR_CYAN },
-        { Colors::White,   COLOR_WHITE },
+    static constexpr int builtin_colors[] = {
+        -1, // Colors::Default
+        COLOR_BLACK,
+        COLOR_RED,
+        COLOR_GREEN,
+        COLOR_YELLOW,
+        COLOR_BLUE,
+        COLOR_MAGENTA,
+        COLOR_CYAN,
+        COLOR_WHITE,
     };
+    static std::unordered_map<uint32_t, int> rgb_colors;
     static int next_color = 8;
 
-    auto it = colors.find(color);
-    if (it != colors.end())
+    if (color.color != Colors::RGB)
+        return builtin_colors[(int)color.color];
+
+    auto it = rgb_colors.find(color_key(color));
+    if (it != rgb_colors.end())
         return it->second;
     else if (can_change_color() and COLORS > 8)
     {
-        kak_assert(color.color == Colors::RGB);
         if (next_color > COLORS)
             next_color = 8;
         init_color(next_color,
                    color.r * 1000 / 255,
                    color.g * 1000 / 255,
                    color.b * 1000 / 255);
-        colors[color] = next_color;
+        rgb_colors[color_key(color)] = next_color;
         return next_color++;
     }
     else
     {
-        kak_assert(color.color == Colors::RGB);
         // project to closest color.
         struct BuiltinColor { int id; unsigned char r, g, b; };
         static constexpr BuiltinColor builtins[] = {
@@ -107,32 +99,55 @@ static int nc_color(Color color)
 
 static int get_color_pair(ColorPair colors)
 {
-    static std::map<ColorPair, int> colorpairs;
+    constexpr int named_color_count = (int)Colors::RGB;
+    // 0 means the pair was not initialized yet
+    static int named_pairs[named_color_count][named_color_count] = {};
+    static std::unordered_map<uint64_t, int> rgb_pairs;
     static int next_pair = 1;
 
-    auto it = colorpairs.find(colors);
-    if (it != colorpairs.end())
-        return it->second;
+    int* pair;
+    if (colors.first.color != Colors::RGB and colors.second.color != Colors::RGB)
+        pair = &named_pairs[(int)colors.first.color][(int)colors.second.color];
     else
+        pair = &rgb_pairs[(uint64_t)color_key(colors.first) << 32 |
+                          color_key(colors.second)];
+
+    if (*pair == 0)
     {
         init_pair(next_pair, nc_color(colors.first), nc_color(colors.second));
-        colorpairs[colors] = next_pair;
-        return next_pair++;
+        *pair = next_pair++;
     }
+    return *pair;
+}
+
+static attr_t nc_attributes(Attribute attribute)
+{
+    return (attribute & Underline ? A_UNDERLINE : 0) |
+           (attribute & Reverse ? A_REVERSE : 0) |
+           (attribute & Blink ? A_BLINK : 0) |
+           (attribute & Bold ? A_BOLD : 0);
 }
 
-static void set_color(WINDOW* window, ColorPair colors)
+// only update stdscr attributes when they differ from the current ones,
+// most consecutive atoms share their colors and attributes.
+static void set_attributes(Attribute attribute, ColorPair colors)
 {
-    static int current_pair = -1;
+    static bool initialized = false;
+    static Attribute current_attribute;
+    static ColorPair current_colors;
 
-    if (current_pair != -1)
-        wattroff(window, COLOR_PAIR(current_pair));
+    if (initialized and attribute == current_attribute and
+        colors == current_colors)
+        return;
 
+    int pair = 0;
     if (colors.first != Colors::Default or colors.second != Colors::Default)
-    {
-        current_pair = get_color_pair(colors);
-        wattron(window, COLOR_PAIR(current_pair));
-    }
+        pair = get_color_pair(colors);
+    wattrset(stdscr, nc_attributes(attribute) | COLOR_PAIR(pair));
+
+    initialized = true;
+    current_attribute = attribute;
+    current_colors = colors;
 }
 
 void on_term_resize(int)
@@ -143,6 +158,7 @@ void on_term_resize(int)
 
 void on_sigint(int)
 {
+    RegexBudget::interrupt();
     ungetch(CTRL('c'));
     EventManager::instance().force_signal(0);
 }
@@ -158,10 +174,23 @@ NCursesUI::NCursesUI()
     intrflush(stdscr, false);
     keypad(stdscr, true);
     curs_set(0);
+    // let curses use the terminal insert/delete line capabilities, so that
+    // scrolling the screen does not redraw every line
+    idlok(stdscr, true);
     start_color();
     use_default_colors();
     set_escdelay(25);
 
+    // the terminal capabilities used to set the title do not change
+    const char* tsl = tigetstr((char*)"tsl");
+    const char* fsl = tigetstr((char*)"fsl");
+    if (tsl != 0 and (ptrdiff_t)tsl != -1 and
+        fsl != 0 and (ptrdiff_t)fsl != -1)
+    {
+        m_title_start = tsl;
+        m_title_end = fsl;
+    }
+
     signal(SIGWINCH, on_term_resize);
     signal(SIGINT, on_sigint);
 
@@ -215,62 +244,206 @@ void NCursesUI::update_dimensions()
 {
     m_dimensions = window_size(stdscr);
     --m_dimensions.line;
+    m_line_hashes.clear();
 }
 
 void NCursesUI::draw_line(const DisplayLine& line, CharCount col_index) const
 {
+    for (const DisplayAtom& atom : line.prefix())
+        draw_atom(atom, col_index);
     for (const DisplayAtom& atom : line)
+        draw_atom(atom, col_index);
+}
+
+void NCursesUI::draw_atom(const DisplayAtom& atom, CharCount& col_index) const
+{
+    set_attributes(atom.attribute, atom.colors);
+
+    // draw directly from the atom content, without copying it
+    using CharIterator = utf8::utf8_iterator<const char*, Utf8Policy>;
+    memoryview<char> content = atom.content_view();
+    if (content.empty())
+        return;
+
+    CharIterator begin{content.begin()}, end{content.end()};
+    if (content.back() == '\n' and
+        (end - begin) - 1 < m_dimensions.column - col_index)
+    {
+        waddnstr(stdscr, content.begin(), (int)content.size() - 1);
+        addch(' ');
+    }
+    else
+    {
+        if (end - begin > m_dimensions.column - col_index)
+            end = begin + (m_dimensions.column - col_index);
+        waddnstr(stdscr, begin.base(), (int)(end.base() - begin.base()));
+        col_index += end - begin;
+    }
+}
+
+static size_t hash_bytes(size_t hash, const char* begin, const char* end)
+{
+    // FNV-1a
+    for (auto it = begin; it != end; ++it)
+        hash = (hash ^ (unsigned char)*it) * 1099511628211ul;
+    return hash;
+}
+
+template<typename T>
+static size_t hash_value(size_t hash, const T& value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    return hash_bytes(hash, bytes, bytes + sizeof(T));
+}
+
+static size_t hash_color(size_t hash, Color color)
+{
+    hash = hash_value(hash, color.color);
+    if (color.color == Colors::RGB)
     {
-        set_attribute(A_UNDERLINE, atom.attribute & Underline);
-        set_attribute(A_REVERSE, atom.attribute & Reverse);
-        set_attribute(A_BLINK, atom.attribute & Blink);
-        set_attribute(A_BOLD, atom.attribute & Bold);
+        hash = hash_value(hash, color.r);
+        hash = hash_value(hash, color.g);
+        hash = hash_value(hash, color.b);
+    }
+    return hash;
+}
+
+static size_t hash_line(const DisplayLine& line)
+{
+    size_t hash = 14695981039346656037ul;
+    auto hash_atoms = [&](const AtomList& atoms) {
+        for (auto& atom : atoms)
+        {
+            auto content = atom.content_view();
+            hash = hash_bytes(hash, content.begin(), content.end());
+            hash = hash_color(hash, atom.colors.first);
+            hash = hash_color(hash, atom.colors.second);
+            hash = hash_value(hash, atom.attribute);
+            // separate atoms so that moving text from one to another changes the hash
+            hash = hash_value(hash, '\0');
+        }
+    };
+    hash_atoms(line.prefix());
+    hash = hash_value(hash, '\n');
+    hash_atoms(line.atoms());
+    return hash;
+}
+
+// hash of the lines past the end of the buffer
+static constexpr size_t filler_line_hash = 0;
+// hash of the lines whose screen content is not known
+static constexpr size_t invalid_line_hash = -1;
+
+// when the display lines moved up or down by a few lines since the last
+// draw, scroll the screen so that these lines are already in place.
+void NCursesUI::scroll_ifn(const std::vector<size_t>& hashes)
+{
+    const int line_count = (int)hashes.size();
+    if ((int)m_line_hashes.size() != line_count)
+        return;
 
-        set_color(stdscr, atom.colors);
+    auto matching_lines = [&](int offset) {
+        int count = 0;
+        for (int line = std::max(0, -offset); line < std::min(line_count, line_count - offset); ++line)
+            count += hashes[line] == m_line_hashes[line + offset] ? 1 : 0;
+        return count;
+    };
 
-        String content = atom.content();
-        if (content[content.length()-1] == '\n' and
-            content.char_length() - 1 < m_dimensions.column - col_index)
+    // the screen moved by the offset at which the old lines contain the new
+    // first line when scrolling down, or the new last one when scrolling
+    // up, only these two candidates are checked.
+    const int max_offset = line_count / 2;
+    auto first_candidate = [&]() {
+        for (int offset = 1; offset <= max_offset; ++offset)
         {
-            addutf8str(stdscr, Utf8Iterator{content.begin()},
-                               Utf8Iterator{content.end()}-1);
-            addch(' ');
+            if (m_line_hashes[offset] == hashes[0])
+                return offset;
         }
-        else
+        return 0;
+    };
+    auto last_candidate = [&]() {
+        int last = line_count - 1;
+        while (last > 0 and hashes[last] == filler_line_hash)
+            --last;
+        for (int offset = 1; offset <= max_offset and last - offset >= 0; ++offset)
         {
-            Utf8Iterator begin{content.begin()}, end{content.end()};
-            if (end - begin > m_dimensions.column - col_index)
-                end = begin + (m_dimensions.column - col_index);
-            addutf8str(stdscr, begin, end);
-            col_index += end - begin;
+            if (m_line_hashes[last - offset] == hashes[last])
+                return -offset;
+        }
+        return 0;
+    };
+
+    int best_offset = 0;
+    int best_count = matching_lines(0);
+    for (int offset : { first_candidate(), last_candidate() })
+    {
+        const int count = offset != 0 ? matching_lines(offset) : 0;
+        if (count > best_count)
+        {
+            best_offset = offset;
+            best_count = count;
         }
     }
+    if (best_offset == 0)
+        return;
+
+    // the status line is not part of the scrolled region
+    wsetscrreg(stdscr, 0, std::min(line_count, (int)m_dimensions.line) - 1);
+    scrollok(stdscr, true);
+    wscrl(stdscr, best_offset);
+    scrollok(stdscr, false);
+
+    std::vector<size_t> scrolled(line_count, invalid_line_hash);
+    for (int line = std::max(0, -best_offset); line < std::min(line_count, line_count - best_offset); ++line)
+        scrolled[line] = m_line_hashes[line + best_offset];
+    m_line_hashes = std::move(scrolled);
 }
 
 void NCursesUI::draw(const DisplayBuffer& display_buffer,
                      const DisplayLine& status_line,
                      const DisplayLine& mode_line)
 {
+    std::vector<size_t> hashes;
+    hashes.reserve((int)m_dimensions.line);
+    for (const DisplayLine& line : display_buffer.lines())
+        hashes.push_back(hash_line(line));
+    hashes.resize(std::max((int)hashes.size(), (int)m_dimensions.line), filler_line_hash);
+
+    scroll_ifn(hashes);
+
+    // only draw the lines which are not already on screen
+    auto unchanged = [&](LineCount line) {
+        return (int)line < (int)m_line_hashes.size() and
+               m_line_hashes[(int)line] == hashes[(int)line];
+    };
+
     LineCount line_index = 0;
     for (const DisplayLine& line : display_buffer.lines())
     {
-        wmove(stdscr, (int)line_index, 0);
-        wclrtoeol(stdscr);
+        if (not unchanged(line_index))
+        {
+            wmove(stdscr, (int)line_index, 0);
+            wclrtoeol(stdscr);
             draw_line(line, 0);
+            // a line wider than the screen (for example with double width
+            // characters) wraps on the following ones, they must be redrawn
+            for (int next = (int)line_index + 1;
+                 next <= getcury(stdscr) and next < (int)m_line_hashes.size(); ++next)
+                m_line_hashes[next] = invalid_line_hash;
+        }
         ++line_index;
     }
 
-    set_attribute(A_UNDERLINE, 0);
-    set_attribute(A_REVERSE, 0);
-    set_attribute(A_BLINK, 0);
-    set_attribute(A_BOLD, 0);
-    set_color(stdscr, { Colors::Blue, Colors::Default });
+    set_attributes(Normal, { Colors::Blue, Colors::Default });
     for (;line_index < m_dimensions.line; ++line_index)
     {
+        if (unchanged(line_index))
+            continue;
         move((int)line_index, 0);
         clrtoeol();
         addch('~');
     }
+    m_line_hashes = std::move(hashes);
 
     move((int)m_dimensions.line, 0);
     clrtoeol();
@@ -284,16 +457,13 @@ void NCursesUI::draw(const DisplayBuffer& display_buffer,
         draw_line(mode_line, col);
     }
 
-    const char* tsl = tigetstr((char*)"tsl");
-    const char* fsl = tigetstr((char*)"fsl");
-    if (tsl != 0 and (ptrdiff_t)tsl != -1 and
-        fsl != 0 and (ptrdiff_t)fsl != -1)
+    if (m_title_start and m_title_end)
     {
         String title;
         for (auto& atom : mode_line)
             title += atom.content();
         title += " - Kakoune";
-        printf("%s%s%s", tsl, title.c_str(), fsl);
+        printf("%s%s%s", m_title_start, title.c_str(), m_title_end);
     }
 
     redraw();
@@ -46,10 +46,16 @@ private:
     friend void on_term_resize(int);
     void redraw();
     void draw_line(const DisplayLine& line, CharCount col_index) const;
+    void draw_atom(const DisplayAtom& atom, CharCount& col_index) const;
 
     DisplayCoord m_dimensions;
     void update_dimensions();
 
+    // hashes of the lines drawn by the last draw call, used to only
+    // draw the lines which changed.
+    std::vector<size_t> m_line_hashes;
+    void scroll_ifn(const std::vector<size_t>& hashes);
+
     NCursesWin* m_menu_win = nullptr;
     std::vector<String> m_items;
     ColorPair m_menu_fg;
@@ -61,6 +67,10 @@ private:
 
     NCursesWin* m_info_win = nullptr;
 
+    // terminal title escape sequences, null if not supported
+    const char* m_title_start = nullptr;
+    const char* m_title_end = nullptr;
+
     FDWatcher     m_stdin_watcher;
     InputCallback m_input_callback;
 };
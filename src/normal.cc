@@ -8,6 +8,7 @@
 #include "commands.hh"
 #include "context.hh"
 #include "file.hh"
+#include "line_regex.hh"
 #include "option_manager.hh"
 #include "register_manager.hh"
 #include "selectors.hh"
@@ -533,6 +534,13 @@ void search(Context& context, int)
                 if (event == PromptEvent::Validate)
                     throw;
             }
+            catch (std::runtime_error& err)
+            {
+                // boost gave up on a too complex match
+                context.selections() = selections;
+                if (event == PromptEvent::Validate)
+                    throw runtime_error(err.what());
+            }
         });
 }
 
@@ -553,6 +561,10 @@ void search_next(Context& context, int param)
         {
             throw runtime_error("regex error: "_str + err.what());
         }
+        catch (std::runtime_error& err)
+        {
+            throw runtime_error(err.what());
+        }
     }
     else
         throw runtime_error("no search pattern");
@@ -667,6 +679,10 @@ void regex_prompt(Context& context, const String prompt, T on_validate)
                 {
                     throw runtime_error("regex error: "_str + err.what());
                 }
+                catch (std::runtime_error& err)
+                {
+                    throw runtime_error(err.what());
+                }
             }
             else if (event == PromptEvent::Change)
             {
@@ -754,6 +770,31 @@ void join(Context& context, int param)
     join_select_spaces(context, param);
 }
 
+// returns true if regex matches somewhere in the selection content.
+// single line selections are matched directly in the buffer line memory,
+// avoiding the BufferIterator overhead.
+static bool selection_contains_match(const Buffer& buffer, const Selection& sel,
+                                     const Regex& regex, const LineRegex& line_regex,
+                                     const RegexBudget& budget)
+{
+    const auto& min = sel.min();
+    const auto& max = sel.max();
+    if (min.line == max.line)
+    {
+        const String& line = buffer[min.line];
+        const char* begin = line.c_str() + (int)min.column;
+        const char* end = utf8::next(line.c_str() + (int)max.column);
+        if (not line_regex.empty())
+            return line_regex.search(begin, end);
+        using BudgetCharIterator = BudgetIterator<const char*>;
+        return boost::regex_search(BudgetCharIterator{begin, budget},
+                                   BudgetCharIterator{end, budget}, regex);
+    }
+    return boost::regex_search(BudgetBufferIterator{buffer.iterator_at(min), budget},
+                               BudgetBufferIterator{utf8::next(buffer.iterator_at(max)), budget},
+                               regex);
+}
+
 template<bool matching>
 void keep(Context& context, int)
 {
@@ -762,15 +803,24 @@ void keep(Context& context, int)
         if (ex.empty())
             return;
         const Buffer& buffer = context.buffer();
+        const LineRegex line_regex{ex.str()};
+        const SelectionList& selections = context.selections();
         SelectionList keep;
-        for (auto& sel : context.selections())
+        size_t main_index = 0;
+        RegexBudget budget;
+        for (size_t i = 0; i < selections.size(); ++i)
         {
-            if (boost::regex_search(buffer.iterator_at(sel.min()),
-                                    utf8::next(buffer.iterator_at(sel.max())), ex) == matching)
+            budget.check();
+            auto& sel = selections[i];
+            if (selection_contains_match(buffer, sel, ex, line_regex, budget) == matching)
                 keep.push_back(sel);
+            // keep the main selection, or the previous kept one if it was removed
+            if (i == selections.main_index())
+                main_index = keep.empty() ? 0 : keep.size() - 1;
         }
         if (keep.empty())
             throw runtime_error("no selections remaining");
+        keep.set_main_index(main_index);
         context.selections() = std::move(keep);
     });
 }
@@ -1213,13 +1263,22 @@ void move(Context& context, int count)
     if (direction == Backward)
         offset = -offset;
     auto& selections = context.selections();
+    std::vector<BufferCoord> lasts;
     for (auto& sel : selections)
+        lasts.push_back(sel.last());
+    if (context.has_window())
+        lasts = context.window().offset_coords(lasts, offset);
+    else
     {
-        auto last = context.has_window() ? context.window().offset_coord(sel.last(), offset)
-                                         : context.buffer().offset_coord(sel.last(), offset);
+        for (auto& last : lasts)
+            last = context.buffer().offset_coord(last, offset);
+    }
 
-        sel.first() = mode == SelectMode::Extend ? sel.first() : last;
-        sel.last()  = last;
+    for (size_t i = 0; i < selections.size(); ++i)
+    {
+        auto& sel = selections[i];
+        sel.first() = mode == SelectMode::Extend ? sel.first() : lasts[i];
+        sel.last()  = lasts[i];
         avoid_eol(context.buffer(), sel);
     }
     selections.sort_and_merge_overlapping();
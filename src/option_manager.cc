@@ -7,8 +7,21 @@
 namespace Kakoune
 {
 
+static size_t next_option_timestamp()
+{
+    static size_t timestamp = 0;
+    return timestamp++;
+}
+
 Option::Option(OptionManager& manager, String name, Flags flags)
-    : m_manager(manager), m_name(std::move(name)), m_flags(flags) {}
+    : m_manager(manager), m_name(std::move(name)), m_flags(flags),
+      m_timestamp(next_option_timestamp()) {}
+
+void Option::changed()
+{
+    m_timestamp = next_option_timestamp();
+    m_manager.on_option_changed(*this);
+}
 
 OptionManager::OptionManager(OptionManager& parent)
     : m_parent(&parent)
@@ -131,6 +144,8 @@ GlobalOptions::GlobalOptions()
     declare_option<bool>("autoinfo", true);
     declare_option<bool>("autoshowcompl", true);
     declare_option<bool>("aligntab", false);
+    declare_option<bool>("profile_highlighters", false);
+    declare_option<int>("highlight_defer_threshold", 10);
     declare_option<Regex>("ignored_files", Regex{R"(^(\..*|.*\.(o|so|a))$)"});
     declare_option<String>("filetype", "");
     declare_option<std::vector<String>>("completions", {});
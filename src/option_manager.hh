@@ -46,6 +46,10 @@ public:
 
     Flags flags() const { return m_flags; }
 
+    // changes each time the value changes, and is never shared between
+    // two options, so that it is enough to identify an option value.
+    size_t timestamp() const { return m_timestamp; }
+
     friend constexpr Flags operator|(Flags lhs, Flags rhs)
     { return (Flags)((int)lhs | (int)rhs); }
 
@@ -53,9 +57,12 @@ public:
     { return (bool)((int)lhs & (int)rhs); }
 
 protected:
+    void changed();
+
     OptionManager& m_manager;
     String m_name;
     Flags  m_flags;
+    size_t m_timestamp;
 };
 
 class OptionManagerWatcher
@@ -118,7 +125,7 @@ public:
             if (m_checker)
                 m_checker(value);
             m_value = std::move(value);
-            m_manager.on_option_changed(*this);
+            changed();
         }
     }
     const T& get() const { return m_value; }
@@ -140,7 +147,7 @@ public:
         if (m_checker)
             m_checker(val);
         if (option_add(m_value, val))
-            m_manager.on_option_changed(*this);
+            changed();
     }
 
     Option* clone(OptionManager& manager) const override
@@ -0,0 +1,172 @@
+#include "profiler.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <numeric>
+
+// only debug builds replace operator new, so that release ones do not
+// pay for counting every allocation.
+#ifdef KAK_DEBUG
+namespace Kakoune
+{
+static size_t allocation_counter = 0;
+}
+
+// array versions and sized delete forward to these by default
+void* operator new(std::size_t size)
+{
+    ++Kakoune::allocation_counter;
+    if (void* ptr = malloc(size))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+#endif
+
+namespace Kakoune
+{
+
+#ifdef KAK_DEBUG
+static constexpr bool counts_allocations = true;
+#else
+static constexpr bool counts_allocations = false;
+#endif
+
+size_t allocation_count()
+{
+#ifdef KAK_DEBUG
+    return allocation_counter;
+#else
+    return 0;
+#endif
+}
+
+Profiler::Section::Section(const String& id)
+{
+    if (not Profiler::has_instance() or not Profiler::instance().enabled())
+        return;
+
+    m_profiler = &Profiler::instance();
+    String& path = m_profiler->m_path;
+    m_parent_path_length = path.size();
+    if (not path.empty())
+        path += '/';
+    path += id;
+    m_start = Clock::now();
+    m_start_allocations = allocation_count();
+}
+
+Profiler::Section::~Section()
+{
+    if (not m_profiler)
+        return;
+
+    const auto elapsed = Clock::now() - m_start;
+    const size_t allocations = allocation_count() - m_start_allocations;
+    String& path = m_profiler->m_path;
+    Stats& stats = m_profiler->m_stats[path];
+    stats.total += elapsed;
+    stats.frame_total += elapsed;
+    stats.allocations += allocations;
+    ++stats.calls;
+    path.resize(m_parent_path_length);
+}
+
+void Profiler::begin_frame()
+{
+    m_frame_start_allocations = allocation_count();
+}
+
+void Profiler::end_frame()
+{
+    if (not m_enabled)
+        return;
+
+    ++m_frame_count;
+    m_frame_allocations.push_back(allocation_count() - m_frame_start_allocations);
+    for (auto& stats : m_stats)
+    {
+        // sections which did not run during this frame are not sampled
+        if (stats.second.frame_total == Clock::duration{})
+            continue;
+        stats.second.frame_totals.push_back(stats.second.frame_total);
+        stats.second.frame_total = Clock::duration{};
+    }
+}
+
+static String pad_left(const String& str, int width)
+{
+    const int padding = std::max(1, width - (int)str.length());
+    return String{' ', CharCount{padding}} + str;
+}
+
+static String format_us(Profiler::Clock::duration duration)
+{
+    using namespace std::chrono;
+    return pad_left(to_string((int)duration_cast<microseconds>(duration).count()), 10);
+}
+
+std::vector<String> Profiler::report() const
+{
+    using StatsIt = decltype(m_stats)::const_iterator;
+    std::vector<StatsIt> sorted;
+    for (auto it = m_stats.begin(); it != m_stats.end(); ++it)
+        sorted.push_back(it);
+    std::sort(sorted.begin(), sorted.end(), [](StatsIt lhs, StatsIt rhs)
+              { return lhs->second.total > rhs->second.total; });
+
+    std::vector<String> res;
+    res.push_back("profile over " + to_string((int)m_frame_count) +
+                  " frames, times in microseconds, per frame ones for the"
+                  " frames where the section ran");
+    if (counts_allocations and not m_frame_allocations.empty())
+    {
+        auto frame_allocations = m_frame_allocations;
+        std::sort(frame_allocations.begin(), frame_allocations.end());
+        const size_t count = frame_allocations.size();
+        const size_t sum = std::accumulate(frame_allocations.begin(),
+                                           frame_allocations.end(), (size_t)0);
+        res.push_back("allocations per frame: mean " + to_string((int)(sum / count)) +
+                      ", p99 " + to_string((int)frame_allocations[(count * 99 + 99) / 100 - 1]));
+    }
+    res.push_back(String{"     total      mean       p99     calls"} +
+                  (counts_allocations ? "    allocs" : "") + "  section");
+    for (auto& it : sorted)
+    {
+        const Stats& stats = it->second;
+        auto frame_totals = stats.frame_totals;
+        Clock::duration mean{}, p99{};
+        if (not frame_totals.empty())
+        {
+            std::sort(frame_totals.begin(), frame_totals.end());
+            p99 = frame_totals[(frame_totals.size() * 99 + 99) / 100 - 1];
+            mean = std::accumulate(frame_totals.begin(), frame_totals.end(),
+                                   Clock::duration{}) / frame_totals.size();
+        }
+        res.push_back(format_us(stats.total) + format_us(mean) + format_us(p99) +
+                      pad_left(to_string((int)stats.calls), 10) +
+                      (counts_allocations ? pad_left(to_string((int)stats.allocations), 10)
+                                          : String{}) + "  " + it->first);
+    }
+    return res;
+}
+
+size_t Profiler::calls(const String& path) const
+{
+    auto it = m_stats.find(path);
+    return it != m_stats.end() ? it->second.calls : 0;
+}
+
+void Profiler::reset()
+{
+    m_frame_count = 0;
+    m_stats.clear();
+    m_frame_allocations.clear();
+}
+
+}
@@ -0,0 +1,81 @@
+#ifndef profiler_hh_INCLUDED
+#define profiler_hh_INCLUDED
+
+#include "string.hh"
+#include "utils.hh"
+
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+namespace Kakoune
+{
+
+// number of heap allocations since startup, counted by the global
+// operator new replacement in profiler.cc, which is only built in debug
+// builds. Always 0 in the other ones.
+size_t allocation_count();
+
+// Profiler records the time spent in named sections, which can be nested.
+//
+// Sections are identified by the path of ids of the sections they are
+// nested in, and their times include the time of the nested sections.
+// Times are accumulated per frame so that the report can show per frame
+// statistics, along with the heap allocations done in each section and
+// during whole frames. When disabled, sections only cost a flag check.
+class Profiler : public Singleton<Profiler>
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    bool enabled() const { return m_enabled; }
+    void set_enabled(bool enabled) { m_enabled = enabled; }
+
+    class Section
+    {
+    public:
+        Section(const String& id);
+        ~Section();
+
+        Section(const Section&) = delete;
+        Section& operator=(const Section&) = delete;
+
+    private:
+        Profiler*         m_profiler = nullptr;
+        size_t            m_parent_path_length;
+        Clock::time_point m_start;
+        size_t            m_start_allocations;
+    };
+
+    void begin_frame();
+    void end_frame();
+
+    // one line per section, sorted by decreasing total time
+    std::vector<String> report() const;
+
+    // number of times the section at path ran since the last reset
+    size_t calls(const String& path) const;
+    void reset();
+
+private:
+    struct Stats
+    {
+        Clock::duration total{};
+        size_t          calls = 0;
+        size_t          allocations = 0;
+        Clock::duration frame_total{};
+        std::vector<Clock::duration> frame_totals;
+    };
+
+    bool   m_enabled = false;
+    String m_path;
+    size_t m_frame_count = 0;
+    std::unordered_map<String, Stats> m_stats;
+
+    size_t              m_frame_start_allocations = 0;
+    std::vector<size_t> m_frame_allocations;
+};
+
+}
+
+#endif // profiler_hh_INCLUDED
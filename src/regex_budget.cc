@@ -0,0 +1,49 @@
+#include "regex_budget.hh"
+
+#include "exception.hh"
+
+#include <signal.h>
+
+namespace Kakoune
+{
+
+static volatile sig_atomic_t interrupt_requested = 0;
+static RegexBudget::InterruptPoller interrupt_poller;
+
+// polling may need system calls, do not do it on every check
+static constexpr auto poll_interval = std::chrono::milliseconds{50};
+
+RegexBudget::RegexBudget(std::chrono::milliseconds budget)
+    : m_deadline(Clock::now() + budget),
+      m_next_poll(Clock::now() + poll_interval)
+{
+    // only interrupts requested during this operation are considered
+    interrupt_requested = 0;
+}
+
+void RegexBudget::check() const
+{
+    const auto now = Clock::now();
+    if (interrupt_poller and now > m_next_poll)
+    {
+        if (interrupt_poller())
+            interrupt_requested = 1;
+        m_next_poll = now + poll_interval;
+    }
+    if (interrupt_requested)
+        throw runtime_error("regex operation interrupted");
+    if (now > m_deadline)
+        throw runtime_error("regex operation timed out");
+}
+
+void RegexBudget::set_interrupt_poller(InterruptPoller poller)
+{
+    interrupt_poller = std::move(poller);
+}
+
+void RegexBudget::interrupt()
+{
+    interrupt_requested = 1;
+}
+
+}
@@ -0,0 +1,80 @@
+#ifndef regex_budget_hh_INCLUDED
+#define regex_budget_hh_INCLUDED
+
+#include <chrono>
+#include <functional>
+
+#include <boost/iterator/iterator_adaptor.hpp>
+
+namespace Kakoune
+{
+
+// RegexBudget bounds regex operations running on the main loop.
+//
+// Input events are only processed once the current operation returns,
+// so a pathological regex would otherwise freeze every client. check()
+// is expected to be called between matches, it throws a runtime_error
+// once the time budget is exhausted or when an interrupt was requested.
+// A single match is bounded by matching on BudgetIterators.
+class RegexBudget
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit RegexBudget(std::chrono::milliseconds budget = std::chrono::seconds{5});
+
+    void check() const;
+
+    // called on each iterator move, checks once in a while
+    void tick() const
+    {
+        if (++m_ticks % 4096 == 0)
+            check();
+    }
+
+    // request the interruption of the current operation, this is
+    // async signal safe so that it can be called on SIGINT.
+    static void interrupt();
+
+    // polled during operations, returns true when an interruption was
+    // requested by a peer whose input cannot be processed meanwhile.
+    using InterruptPoller = std::function<bool ()>;
+    static void set_interrupt_poller(InterruptPoller poller);
+
+private:
+    Clock::time_point         m_deadline;
+    mutable Clock::time_point m_next_poll;
+    mutable size_t            m_ticks = 0;
+};
+
+// BudgetIterator wraps the iterators a regex is matched on, checking
+// the budget as they are moved.
+template<typename Iterator>
+class BudgetIterator
+    : public boost::iterator_adaptor<BudgetIterator<Iterator>, Iterator,
+                                     boost::use_default, boost::use_default,
+                                     typename std::iterator_traits<Iterator>::value_type,
+                                     std::ptrdiff_t>
+{
+public:
+    BudgetIterator() = default;
+    BudgetIterator(Iterator it, const RegexBudget& budget)
+        : BudgetIterator::iterator_adaptor_(it), m_budget(&budget) {}
+
+private:
+    friend class boost::iterator_core_access;
+
+    void increment() { tick(); ++this->base_reference(); }
+    void decrement() { tick(); --this->base_reference(); }
+    void advance(std::ptrdiff_t n) { tick(); this->base_reference() += n; }
+    std::ptrdiff_t distance_to(const BudgetIterator& other) const
+    { return other.base() - this->base(); }
+
+    void tick() const { if (m_budget) m_budget->tick(); }
+
+    const RegexBudget* m_budget = nullptr;
+};
+
+}
+
+#endif // regex_budget_hh_INCLUDED
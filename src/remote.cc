@@ -6,6 +6,7 @@
 #include "debug.hh"
 #include "display_buffer.hh"
 #include "event_manager.hh"
+#include "regex_budget.hh"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -93,13 +94,17 @@ public:
 
     void write(const DisplayAtom& atom)
     {
-        write(atom.content());
+        // same format as a String, written without copying the content
+        memoryview<char> content = atom.content_view();
+        write(ByteCount{(int)content.size()});
+        write(content.pointer(), content.size());
         write(atom.colors);
         write(atom.attribute);
     }
 
     void write(const DisplayLine& line)
     {
+        write(line.prefix());
         write(line.atoms());
     }
 
@@ -199,7 +204,10 @@ DisplayAtom read<DisplayAtom>(int socket)
 template<>
 DisplayLine read<DisplayLine>(int socket)
 {
-    return DisplayLine(read_vector<DisplayAtom>(socket));
+    AtomList prefix = read_vector<DisplayAtom>(socket);
+    DisplayLine line(read_vector<DisplayAtom>(socket));
+    line.prefix() = std::move(prefix);
+    return line;
 }
 
 template<>
@@ -244,18 +252,46 @@ private:
 };
 
 
+// sockets of the connected remote uis
+static std::vector<int> remote_ui_sockets;
+
 RemoteUI::RemoteUI(int socket)
     : m_socket_watcher(socket, [this](FDWatcher&) { if (m_input_callback) m_input_callback(); })
 {
     write_debug("remote client connected: " + to_string(m_socket_watcher.fd()));
+    remote_ui_sockets.push_back(socket);
 }
 
 RemoteUI::~RemoteUI()
 {
     write_debug("remote client disconnected: " + to_string(m_socket_watcher.fd()));
+    remote_ui_sockets.erase(std::find(remote_ui_sockets.begin(),
+                                      remote_ui_sockets.end(),
+                                      m_socket_watcher.fd()));
     close(m_socket_watcher.fd());
 }
 
+// remote client input is not processed while a regex operation runs,
+// so peek in it for a <c-c> requesting the interruption of the operation.
+// Like the one a local SIGINT pushes back, that <c-c> is then handled as
+// a normal key, cancelling the prompt or mode the operation came from.
+static bool remote_interrupt_pending()
+{
+    for (auto sock : remote_ui_sockets)
+    {
+        char buffer[64 * sizeof(Key)];
+        ssize_t res = recv(sock, buffer, sizeof(buffer), MSG_PEEK | MSG_DONTWAIT);
+        for (ssize_t pos = 0; pos + (ssize_t)sizeof(Key) <= res; pos += sizeof(Key))
+        {
+            Key key = Key::Invalid;
+            memcpy(&key, buffer + pos, sizeof(Key));
+            if (key == ctrl('c'))
+                return true;
+        }
+    }
+    return false;
+}
+
 void RemoteUI::menu_show(memoryview<String> choices,
                          DisplayCoord anchor, ColorPair fg, ColorPair bg,
                          MenuStyle style)
@@ -539,10 +575,12 @@ Server::Server(String session_name)
         new ClientAccepter{sock};
     };
     m_listener.reset(new FDWatcher{listen_sock, accepter});
+    RegexBudget::set_interrupt_poller(remote_interrupt_pending);
 }
 
 Server::~Server()
 {
+    RegexBudget::set_interrupt_poller(nullptr);
     unlink(("/tmp/kak-" + m_session).c_str());
     close(m_listener->fd());
 }
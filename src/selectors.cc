@@ -1,5 +1,6 @@
 #include "selectors.hh"
 
+#include "regex_budget.hh"
 #include "string.hh"
 
 #include <algorithm>
@@ -409,23 +410,26 @@ void select_all_matches(const Buffer& buffer, SelectionList& selections,
                         const Regex& regex)
 {
     SelectionList result;
+    RegexBudget budget;
     for (auto& sel : selections)
     {
         auto sel_end = utf8::next(buffer.iterator_at(sel.max()));
-        RegexIterator re_it(buffer.iterator_at(sel.min()), sel_end, regex);
-        RegexIterator re_end;
+        BudgetRegexIterator re_it({buffer.iterator_at(sel.min()), budget},
+                                  {sel_end, budget}, regex);
+        BudgetRegexIterator re_end;
 
         for (; re_it != re_end; ++re_it)
         {
-            auto& begin = (*re_it)[0].first;
-            auto& end   = (*re_it)[0].second;
+            budget.check();
+            auto begin = (*re_it)[0].first.base();
+            auto end   = (*re_it)[0].second.base();
 
             if (begin == sel_end)
                 continue;
 
             CaptureList captures;
             for (auto& match : *re_it)
-                captures.emplace_back(match.first, match.second);
+                captures.emplace_back(match.first.base(), match.second.base());
 
             result.emplace_back(begin.coord(),
                                 (begin == end ? end : utf8::previous(end)).coord(),
@@ -442,20 +446,22 @@ void split_selections(const Buffer& buffer, SelectionList& selections,
                       const Regex& regex)
 {
     SelectionList result;
+    RegexBudget budget;
     for (auto& sel : selections)
     {
         auto begin = buffer.iterator_at(sel.min());
         auto sel_end = utf8::next(buffer.iterator_at(sel.max()));
-        RegexIterator re_it(begin, sel_end, regex,
-                            boost::regex_constants::match_nosubs);
-        RegexIterator re_end;
+        BudgetRegexIterator re_it({begin, budget}, {sel_end, budget}, regex,
+                                  boost::regex_constants::match_nosubs);
+        BudgetRegexIterator re_end;
 
         for (; re_it != re_end; ++re_it)
         {
-            BufferIterator end = (*re_it)[0].first;
+            budget.check();
+            BufferIterator end = (*re_it)[0].first.base();
 
             result.emplace_back(begin.coord(), (begin == end) ? end.coord() : utf8::previous(end).coord());
-            begin = (*re_it)[0].second;
+            begin = (*re_it)[0].second.base();
         }
         if (begin.coord() <= sel.max())
             result.emplace_back(begin.coord(), sel.max());
@@ -1,6 +1,7 @@
 #ifndef selectors_hh_INCLUDED
 #define selectors_hh_INCLUDED
 
+#include "regex_budget.hh"
 #include "selection.hh"
 #include "unicode.hh"
 #include "utf8_iterator.hh"
@@ -211,17 +212,24 @@ Selection trim_partial_lines(const Buffer& buffer, const Selection& selection);
 
 enum Direction { Forward, Backward };
 
-using MatchResults = boost::match_results<BufferIterator>;
+// matching on budgeted iterators bounds each regex search
+using BudgetBufferIterator = BudgetIterator<BufferIterator>;
+using MatchResults = boost::match_results<BudgetBufferIterator>;
+using BudgetRegexIterator = boost::regex_iterator<BudgetBufferIterator>;
 
-static bool find_last_match(BufferIterator begin, const BufferIterator& end,
-                            MatchResults& res, const Regex& regex)
+static bool find_last_match(const BufferIterator& begin, const BufferIterator& end,
+                            MatchResults& res, const Regex& regex,
+                            const RegexBudget& budget)
 {
     MatchResults matches;
-    while (boost::regex_search(begin, end, matches, regex))
+    BudgetBufferIterator pos{begin, budget};
+    while (boost::regex_search(pos, BudgetBufferIterator{end, budget},
+                               matches, regex))
     {
-        if (begin == matches[0].second)
+        budget.check();
+        if (pos == matches[0].second)
             break;
-        begin = matches[0].second;
+        pos = matches[0].second;
         res.swap(matches);
     }
     return not res.empty();
@@ -229,14 +237,19 @@ static bool find_last_match(BufferIterator begin, const BufferIterator& end,
 
 template<Direction direction>
 bool find_match_in_buffer(const Buffer& buffer, const BufferIterator pos,
-                          MatchResults& matches, const Regex& ex)
+                          MatchResults& matches, const Regex& ex,
+                          const RegexBudget& budget)
 {
+    auto search = [&](const BufferIterator& begin, const BufferIterator& end) {
+        return boost::regex_search(BudgetBufferIterator{begin, budget},
+                                   BudgetBufferIterator{end, budget},
+                                   matches, ex);
+    };
     if (direction == Forward)
-        return (boost::regex_search(pos, buffer.end(), matches, ex) or
-                boost::regex_search(buffer.begin(), pos, matches, ex));
+        return search(pos, buffer.end()) or search(buffer.begin(), pos);
     else
-        return (find_last_match(buffer.begin(), pos, matches, ex) or
-                find_last_match(pos, buffer.end(), matches, ex));
+        return (find_last_match(buffer.begin(), pos, matches, ex, budget) or
+                find_last_match(pos, buffer.end(), matches, ex, budget));
 }
 
 template<Direction direction>
@@ -247,13 +260,14 @@ Selection find_next_match(const Buffer& buffer, const Selection& sel, const Rege
 
     CaptureList captures;
     MatchResults matches;
+    RegexBudget budget;
     bool found = false;
-    if ((found = find_match_in_buffer<direction>(buffer, utf8::next(begin), matches, regex)))
+    if ((found = find_match_in_buffer<direction>(buffer, utf8::next(begin), matches, regex, budget)))
     {
-        begin = matches[0].first;
-        end   = matches[0].second;
+        begin = matches[0].first.base();
+        end   = matches[0].second.base();
         for (auto& match : matches)
-            captures.emplace_back(match.first, match.second);
+            captures.emplace_back(match.first.base(), match.second.base());
     }
     if (not found or begin == buffer.end())
         throw runtime_error("'" + regex.str() + "': no matches found");
@@ -1,7 +1,23 @@
 #include "assert.hh"
 #include "buffer.hh"
+#include "buffer_cache.hh"
+#include "client_manager.hh"
+#include "color_registry.hh"
+#include "command_manager.hh"
+#include "context.hh"
+#include "display_buffer.hh"
+#include "highlighter.hh"
+#include "highlighters.hh"
+#include "input_handler.hh"
 #include "keys.hh"
+#include "line_regex.hh"
+#include "option_manager.hh"
+#include "profiler.hh"
 #include "selectors.hh"
+#include "user_interface.hh"
+#include "window.hh"
+
+#include <thread>
 
 using namespace Kakoune;
 
@@ -47,6 +63,41 @@ void test_buffer()
     kak_assert(buffer.string(buffer.advance(buffer.end_coord(), -6), buffer.end_coord()) == "mutch\n");
 }
 
+void test_buffer_changes()
+{
+    Buffer buffer("test", Buffer::Flags::None, { "allo ?\n" });
+    kak_assert(buffer.id() != Buffer("other", Buffer::Flags::None, {}).id());
+
+    const size_t timestamp = buffer.timestamp();
+    buffer.insert(buffer.begin(), "tchou\n");
+    auto changes = buffer.changes_since(timestamp);
+    kak_assert(changes and changes->size() == 1);
+    kak_assert((*changes)[0].type == Buffer::Change::Insert);
+    kak_assert((*changes)[0].end == BufferCoord{1 COMMA 0});
+
+    // old changes are discarded, consumers needing them must start over
+    for (int i = 0; i < 10000; ++i)
+        buffer.insert(buffer.begin(), "a");
+    kak_assert(not buffer.changes_since(timestamp));
+    changes = buffer.changes_since(buffer.timestamp() - 1);
+    kak_assert(changes and changes->size() == 1);
+}
+
+void test_buffer_cache()
+{
+    BufferCache<int> cache;
+    Buffer buffer("test", Buffer::Flags::None, {});
+    {
+        Buffer deleted("deleted", Buffer::Flags::None, {});
+        cache[buffer] = 1;
+        cache[deleted] = 2;
+        kak_assert(cache.size() == 2);
+    }
+    // the deleted buffer entry is evicted on next access
+    kak_assert(cache[buffer] == 1);
+    kak_assert(cache.size() == 1);
+}
+
 void test_undo_group_optimizer()
 {
     std::vector<String> lines = { "allo ?\n", "mais que fais la police\n",  " hein ?\n", " youpi\n" };
@@ -114,11 +165,518 @@ void test_keys()
     kak_assert(keys == parsed_keys);
 }
 
+void test_line_regex()
+{
+    auto same_as_boost = [](const String& pattern, const String& subject) {
+        LineRegex line_regex{pattern};
+        kak_assert(not line_regex.empty());
+
+        const char* begin = subject.c_str();
+        const char* end = begin + (int)subject.length();
+        std::vector<const char*> expected;
+        boost::cregex_iterator re_it{begin, end, Regex{pattern}};
+        for (; re_it != boost::cregex_iterator{}; ++re_it)
+        {
+            for (auto& sub : *re_it)
+            {
+                expected.push_back(sub.matched ? sub.first : nullptr);
+                expected.push_back(sub.matched ? sub.second : nullptr);
+            }
+        }
+
+        std::vector<const char*> result;
+        line_regex.for_each_match(begin, end, [&](const LineRegex::Captures& captures) {
+            result.insert(result.end(), captures.begin(), captures.end());
+        });
+        return result == expected;
+    };
+
+    kak_assert(same_as_boost(R"(\b(if|else|for)\b)", "if (a) for(;;) else_b;\n"));
+    kak_assert(same_as_boost(R"((\w+)\s*=\s*(\d+)?)", "a = 12, b=, c = 3\n"));
+    kak_assert(same_as_boost(R"(^\h*(#|//)[^\n]*$)", "  # comment\n  code // c\n"));
+    kak_assert(same_as_boost(R"(a*?b|(ab)+)", "aab ababab b\n"));
+    kak_assert(same_as_boost(R"(\<[a-c]{2,3}\>|x?)", "ab abcd abc\tbca\n"));
+    kak_assert(same_as_boost(R"((?:"[^"]*")|'.')", R"("foo" 'a' "bar")"));
+
+    kak_assert(LineRegex{R"(\b\w+\b)"}.is_line_local());
+    kak_assert(LineRegex{R"(foo[^\n]*\n)"}.is_line_local());
+    kak_assert(not LineRegex{R"(/\*.*\*/)"}.is_line_local());
+
+    // unsupported features
+    kak_assert(LineRegex{R"((a)\1)"}.empty());
+    kak_assert(LineRegex{R"(a(?=b))"}.empty());
+    kak_assert(LineRegex{R"([[:alpha:]])"}.empty());
+    kak_assert(LineRegex{R"((a*)*)"}.empty());
+
+    // no exponential backtracking
+    String subject{'a', 10000};
+    const char* begin = subject.c_str();
+    kak_assert(not LineRegex{"(a|aa)*b"}.search(begin, begin + (int)subject.length()));
+}
+
+void test_regex_budget()
+{
+    String subject{'a', 10000};
+    const char* begin = subject.c_str();
+    const char* end = begin + (int)subject.length();
+
+    // a single search is interrupted once the budget is exhausted
+    using BudgetCharIterator = BudgetIterator<const char*>;
+    RegexBudget budget{std::chrono::milliseconds{0}};
+    bool timed_out = false;
+    try
+    {
+        boost::regex_search(BudgetCharIterator{begin, budget},
+                            BudgetCharIterator{end, budget}, Regex{"a*b"});
+    }
+    catch (runtime_error&)
+    {
+        timed_out = true;
+    }
+    kak_assert(timed_out);
+
+    Buffer buffer("test", Buffer::Flags::None, { "foo bar\n", "baz foo\n" });
+    Selection sel = find_next_match<Forward>(buffer, Selection{{0, 0}}, Regex{"fo(o)"});
+    kak_assert(sel.first() == BufferCoord(1, 4));
+    kak_assert(sel.last() == BufferCoord(1, 6));
+    kak_assert(sel.captures().size() == 2 and sel.captures()[1] == "o");
+}
+
+static DisplayBuffer highlight_buffer(const Context& context, const HighlighterFunc& highlighter)
+{
+    const Buffer& buffer = context.buffer();
+    DisplayBuffer display_buffer;
+    for (LineCount line = 0; line < buffer.line_count(); ++line)
+        display_buffer.lines().emplace_back(AtomList{ {buffer, line, line+1} });
+    display_buffer.compute_range();
+    highlighter(context, display_buffer);
+    return display_buffer;
+}
+
+static Color color_at(const DisplayBuffer& display_buffer, BufferCoord coord)
+{
+    for (auto& atom : display_buffer.lines()[(int)coord.line])
+    {
+        if (atom.begin() <= coord and coord < atom.end())
+            return atom.colors.first;
+    }
+    return Colors::Default;
+}
+
+void test_offset_coords()
+{
+    std::vector<String> lines;
+    for (int i = 0; i < 30; ++i)
+        lines.push_back(i % 3 == 0 ? "\tfoo bar\n" : (i % 3 == 1 ? "a\tb\tc d\n" : "no tabs here\n"));
+    Buffer buffer("test", Buffer::Flags::None, lines);
+    Window window(buffer);
+
+    // batched offsets are the same as offsetting each coord on its own,
+    // whether lines are highlighted together or in separate groups
+    std::vector<BufferCoord> coords = { {0, 1}, {1, 4}, {3, 6}, {20, 2}, {29, 0} };
+    for (int offset : { 1, -2, 5, 40 })
+    {
+        std::vector<BufferCoord> res = window.offset_coords(coords, LineCount{offset});
+        for (size_t i = 0; i < coords.size(); ++i)
+            kak_assert(res[i] == window.offset_coord(coords[i], LineCount{offset}));
+    }
+    kak_assert(window.offset_coord({0, 1}, 1_line) == BufferCoord(1, 2));
+}
+
+void test_highlight_ranges()
+{
+    Buffer buffer("test", Buffer::Flags::None, { "abcdef\n" });
+    DisplayBuffer display_buffer;
+    DisplayAtom replaced{buffer, {0, 2}, {0, 4}};
+    replaced.replace("X");
+    display_buffer.lines().emplace_back(AtomList{ {buffer, {0, 0}, {0, 2}},
+                                                  std::move(replaced),
+                                                  {buffer, {0, 4}, {1, 0}} });
+    display_buffer.compute_range();
+
+    // a replaced atom cannot be split, the last range covering it wins
+    const Color colors[] = { Colors::Red, Colors::Blue };
+    std::vector<BufferRange> ranges = { { {0, 1}, {0, 3} }, { {0, 3}, {0, 5} } };
+    highlight_ranges(display_buffer, ranges, false,
+                     [&](DisplayAtom& atom, size_t index)
+                     { atom.colors.first = colors[index]; });
+    kak_assert(color_at(display_buffer, {0, 0}) == Colors::Default);
+    kak_assert(color_at(display_buffer, {0, 1}) == Colors::Red);
+    kak_assert(color_at(display_buffer, {0, 2}) == Colors::Blue);
+    kak_assert(color_at(display_buffer, {0, 4}) == Colors::Blue);
+    kak_assert(color_at(display_buffer, {0, 5}) == Colors::Default);
+
+    kak_assert(sorted_and_disjoint(ranges));
+    std::reverse(ranges.begin(), ranges.end());
+    kak_assert(not sorted_and_disjoint(ranges));
+
+    // captures using lookarounds are out of order, and still all applied
+    Buffer regex_buffer("regex_test", Buffer::Flags::None, { "opqz\n" });
+    InputHandler input_handler{regex_buffer, SelectionList{ {} }};
+    std::vector<String> params = { "(?|p(?=.*(z))|(?<=(o).)q)", "1:red" };
+    HighlighterFunc highlighter = HighlighterRegistry::instance()["regex"](params).second;
+    DisplayBuffer regex_display = highlight_buffer(input_handler.context(), highlighter);
+    kak_assert(color_at(regex_display, {0, 0}) == Colors::Red);
+    kak_assert(color_at(regex_display, {0, 1}) == Colors::Default);
+    kak_assert(color_at(regex_display, {0, 3}) == Colors::Red);
+}
+
+void test_regex_highlighter_cache()
+{
+    std::vector<String> lines;
+    for (int i = 0; i < 20; ++i)
+        lines.push_back("foo bar " + to_string(i) + "\n");
+    Buffer buffer("test", Buffer::Flags::None, lines);
+    InputHandler input_handler{buffer, SelectionList{ {} }};
+    const Context& context = input_handler.context();
+
+    std::vector<String> params = { "foo", "0:red" };
+    HighlighterFunc highlighter = HighlighterRegistry::instance()["regex"](params).second;
+
+    // the whole buffer is displayed, only the first pass and no edit
+    // should need a full rescan
+    Profiler& profiler = Profiler::instance();
+    profiler.set_enabled(true);
+    highlight_buffer(context, highlighter);
+    highlight_buffer(context, highlighter);
+    kak_assert(profiler.calls("rescan") == 1);
+
+    buffer.insert(buffer.iterator_at({19, 0}), "foo ");
+    DisplayBuffer display_buffer = highlight_buffer(context, highlighter);
+    kak_assert(profiler.calls("rescan") == 1);
+    kak_assert(color_at(display_buffer, {19, 0}) == Colors::Red);
+    kak_assert(color_at(display_buffer, {19, 4}) == Colors::Red);
+    kak_assert(color_at(display_buffer, {19, 8}) == Colors::Default);
+    kak_assert(color_at(display_buffer, {18, 0}) == Colors::Red);
+
+    profiler.reset();
+    profiler.set_enabled(false);
+}
+
+void test_multi_regex_highlighter()
+{
+    Buffer buffer("test", Buffer::Flags::None, { "foo bar baz\n" });
+    InputHandler input_handler{buffer, SelectionList{ {} }};
+    const Context& context = input_handler.context();
+
+    auto& factory = HighlighterRegistry::instance()["multi_regex"];
+    std::vector<String> params = { "(f)(o+)", "1:red", "2:blue",
+                                   "b(a)r", "0:yellow", "1:green",
+                                   "baz", "0:cyan" };
+    HighlighterFunc highlighter = factory(params).second;
+
+    // capture ids of each regex are shifted to their group in the alternation
+    DisplayBuffer display_buffer = highlight_buffer(context, highlighter);
+    kak_assert(color_at(display_buffer, {0, 0}) == Colors::Red);
+    kak_assert(color_at(display_buffer, {0, 1}) == Colors::Blue);
+    kak_assert(color_at(display_buffer, {0, 3}) == Colors::Default);
+    kak_assert(color_at(display_buffer, {0, 4}) == Colors::Yellow);
+    kak_assert(color_at(display_buffer, {0, 5}) == Colors::Green);
+    kak_assert(color_at(display_buffer, {0, 6}) == Colors::Yellow);
+    kak_assert(color_at(display_buffer, {0, 8}) == Colors::Cyan);
+
+    auto rejected = [&](const String& regex) {
+        std::vector<String> params = { regex, "0:red" };
+        try
+        {
+            factory(params);
+        }
+        catch (runtime_error&)
+        {
+            return true;
+        }
+        return false;
+    };
+    kak_assert(rejected(R"((a)\1)"));
+    kak_assert(rejected(R"((?<n>a)\k<n>)"));
+    kak_assert(rejected(R"((?P<n>a)(?P=n))"));
+    kak_assert(rejected(R"((a)(?1))"));
+    kak_assert(not rejected(R"(\\1)"));
+    kak_assert(not rejected(R"((?-i)a)"));
+}
+
+void test_syntax_highlighter()
+{
+    Buffer buffer("test", Buffer::Flags::None,
+                  { "int a; /* start\n", "int b;\n", "end */ int c;\n", "int d;\n" });
+    InputHandler input_handler{buffer, SelectionList{ {} }};
+    const Context& context = input_handler.context();
+
+    std::vector<String> params = { "test",
+                                   "code", "/\\*", "push:comment", "blue",
+                                   "comment", "\\*/", "pop", "blue",
+                                   "code", "\\bint\\b", "none", "red" };
+    auto make_highlighter = [&] {
+        return HighlighterRegistry::instance()["syntax"](params).second;
+    };
+    HighlighterFunc highlighter = make_highlighter();
+
+    // the comment state is carried from line 0 to line 2
+    DisplayBuffer display_buffer = highlight_buffer(context, highlighter);
+    kak_assert(color_at(display_buffer, {0, 0}) == Colors::Red);
+    kak_assert(color_at(display_buffer, {0, 7}) == Colors::Blue);
+    kak_assert(color_at(display_buffer, {1, 0}) == Colors::Blue);
+    kak_assert(color_at(display_buffer, {2, 5}) == Colors::Blue);
+    kak_assert(color_at(display_buffer, {2, 7}) == Colors::Red);
+    kak_assert(color_at(display_buffer, {3, 0}) == Colors::Red);
+
+    // after an edit, colors are the same as the ones of a new highlighter
+    auto same_as_fresh = [&] {
+        DisplayBuffer updated = highlight_buffer(context, highlighter);
+        DisplayBuffer fresh = highlight_buffer(context, make_highlighter());
+        for (LineCount line = 0; line < buffer.line_count(); ++line)
+        {
+            for (ByteCount col = 0; col < buffer[line].length(); ++col)
+            {
+                if (color_at(updated, {line, col}) != color_at(fresh, {line, col}))
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    buffer.erase(buffer.iterator_at({0, 7}), buffer.iterator_at({0, 9}));
+    kak_assert(same_as_fresh());
+    kak_assert(color_at(highlight_buffer(context, highlighter), {1, 0}) == Colors::Red);
+
+    buffer.insert(buffer.iterator_at({1, 0}), "/*");
+    kak_assert(same_as_fresh());
+    kak_assert(color_at(highlight_buffer(context, highlighter), {2, 0}) == Colors::Blue);
+
+    buffer.insert(buffer.iterator_at({3, 0}), "/* ");
+    kak_assert(same_as_fresh());
+
+    // nested states are interned as stacks, stacks no line ends with
+    // anymore are collected
+    Option& threshold = GlobalOptions::instance().get_local_option("highlight_defer_threshold");
+    threshold.set<int>(-1);
+    std::vector<String> nested_lines;
+    for (int i = 0; i < 300; ++i)
+        nested_lines.push_back(i % 3 ? "(\n" : "[\n");
+    Buffer nested_buffer("nested_test", Buffer::Flags::None, nested_lines);
+    InputHandler nested_handler{nested_buffer, SelectionList{ {} }};
+    params = { "test",
+               "code", "\\(", "push:paren", "red", "code", "\\[", "push:brack", "blue",
+               "paren", "\\(", "push:paren", "red", "paren", "\\[", "push:brack", "blue",
+               "brack", "\\(", "push:paren", "red", "brack", "\\[", "push:brack", "blue",
+               "paren", "\\)", "pop", "red", "brack", "\\]", "pop", "blue" };
+    highlighter = make_highlighter();
+    Profiler& profiler = Profiler::instance();
+    profiler.set_enabled(true);
+    auto nested_same_as_fresh = [&] {
+        DisplayBuffer updated = highlight_buffer(nested_handler.context(), highlighter);
+        DisplayBuffer fresh = highlight_buffer(nested_handler.context(), make_highlighter());
+        for (LineCount line = 0; line < nested_buffer.line_count(); ++line)
+        {
+            if (color_at(updated, {line, 0}) != color_at(fresh, {line, 0}) or
+                color_at(updated, {line, 1}) != color_at(fresh, {line, 1}))
+                return false;
+        }
+        return true;
+    };
+    for (int i = 0; i < 3; ++i)
+    {
+        nested_buffer.erase(nested_buffer.iterator_at({0, 0}), nested_buffer.iterator_at({1, 0}));
+        kak_assert(nested_same_as_fresh());
+    }
+    kak_assert(profiler.calls("collect_stacks") > 0);
+    kak_assert(nested_same_as_fresh());
+    profiler.reset();
+    profiler.set_enabled(false);
+    threshold.set<int>(10);
+}
+
+void test_line_numbers_highlighter()
+{
+    std::vector<String> lines(12, "foo\n");
+    Buffer buffer("test", Buffer::Flags::None, lines);
+    InputHandler input_handler{buffer, SelectionList{ {} }};
+    const Context& context = input_handler.context();
+
+    HighlighterFunc highlighter = HighlighterRegistry::instance()["number_lines"]({}).second;
+    DisplayBuffer display_buffer = highlight_buffer(context, highlighter);
+    kak_assert(display_buffer.lines()[0].prefix().front().content() == " 1│");
+    kak_assert(display_buffer.lines()[11].prefix().front().content() == "12│");
+
+    // redefining the LineNumbers color applies to existing highlighters
+    ColorRegistry& registry = ColorRegistry::instance();
+    registry.register_alias("LineNumbers", "red", true);
+    display_buffer = highlight_buffer(context, highlighter);
+    kak_assert(display_buffer.lines()[0].prefix().front().colors.first == Colors::Red);
+    registry.register_alias("LineNumbers", "default", true);
+}
+
+void test_flag_lines_highlighter()
+{
+    Buffer buffer_a("test_a", Buffer::Flags::None, { "foo\n", "bar\n" });
+    Buffer buffer_b("test_b", Buffer::Flags::None, { "foo\n", "bar\n" });
+    InputHandler handler_a{buffer_a, SelectionList{ {} }};
+    InputHandler handler_b{buffer_b, SelectionList{ {} }};
+
+    GlobalOptions::instance().declare_option<std::vector<LineAndFlag>>(
+        "test_flags", {}, Option::Flags::Hidden);
+    buffer_a.options().get_local_option("test_flags").set(
+        std::vector<LineAndFlag>{ LineAndFlag{1, Colors::Red, "x"} });
+    buffer_b.options().get_local_option("test_flags").set(
+        std::vector<LineAndFlag>{ LineAndFlag{2, Colors::Blue, "yy"} });
+
+    // one highlighter displays the flags of each buffer, padded to the
+    // widest flag of that buffer
+    std::vector<String> params = { "default", "test_flags" };
+    HighlighterFunc highlighter = HighlighterRegistry::instance()["flag_lines"](params).second;
+    auto flag = [&](const Context& context, int line) {
+        DisplayBuffer display_buffer = highlight_buffer(context, highlighter);
+        return display_buffer.lines()[line].prefix().front();
+    };
+    for (int i = 0; i < 2; ++i)
+    {
+        kak_assert(flag(handler_a.context(), 0).content() == "x");
+        kak_assert(flag(handler_a.context(), 0).colors.first == Colors::Red);
+        kak_assert(flag(handler_a.context(), 1).content() == " ");
+        kak_assert(flag(handler_b.context(), 0).content() == "  ");
+        kak_assert(flag(handler_b.context(), 1).content() == "yy");
+        kak_assert(flag(handler_b.context(), 1).colors.first == Colors::Blue);
+    }
+}
+
+void test_deferred_highlighter()
+{
+    Buffer buffer("test", Buffer::Flags::None, { "a /* b */ c\n", "d\n" });
+    InputHandler input_handler{buffer, SelectionList{ {} }};
+    const Context& context = input_handler.context();
+
+    // every update is slow, the second highlight captures the colors
+    Option& threshold = GlobalOptions::instance().get_local_option("highlight_defer_threshold");
+    threshold.set<int>(0);
+    std::vector<String> params = { "/\\*", "\\*/", "red" };
+    auto make_highlighter = [&] {
+        return HighlighterRegistry::instance()["region"](params).second;
+    };
+    HighlighterFunc highlighter = make_highlighter();
+    highlight_buffer(context, highlighter);
+    highlight_buffer(context, highlighter);
+
+    auto same_as_fresh = [&] {
+        DisplayBuffer updated = highlight_buffer(context, highlighter);
+        DisplayBuffer fresh = highlight_buffer(context, make_highlighter());
+        for (LineCount line = 0; line < buffer.line_count(); ++line)
+        {
+            for (ByteCount col = 0; col < buffer[line].length(); ++col)
+            {
+                if (color_at(updated, {line, col}) != color_at(fresh, {line, col}))
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    // captured colors follow the edit
+    buffer.insert(buffer.iterator_at({0, 0}), "xx");
+    DisplayBuffer display_buffer = highlight_buffer(context, highlighter);
+    kak_assert(color_at(display_buffer, {0, 2}) == Colors::Default);
+    kak_assert(color_at(display_buffer, {0, 4}) == Colors::Red);
+    kak_assert(color_at(display_buffer, {0, 10}) == Colors::Red);
+    kak_assert(color_at(display_buffer, {0, 11}) == Colors::Default);
+    kak_assert(same_as_fresh());
+
+    // the region is not rescanned until the buffer stays unmodified
+    buffer.erase(buffer.iterator_at({0, 4}), buffer.iterator_at({0, 6}));
+    kak_assert(color_at(highlight_buffer(context, highlighter), {0, 4}) == Colors::Red);
+    kak_assert(not same_as_fresh());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{110});
+    kak_assert(color_at(highlight_buffer(context, highlighter), {0, 4}) == Colors::Default);
+    kak_assert(same_as_fresh());
+
+    threshold.set<int>(10);
+}
+
+struct TestUI : UserInterface
+{
+    void menu_show(memoryview<String>, DisplayCoord, ColorPair, ColorPair, MenuStyle) override {}
+    void menu_select(int) override {}
+    void menu_hide() override {}
+    void info_show(const String&, const String&, DisplayCoord, ColorPair, MenuStyle) override {}
+    void info_hide() override {}
+    void draw(const DisplayBuffer&, const DisplayLine&, const DisplayLine&) override {}
+    DisplayCoord dimensions() override { return { 10, 80 }; }
+    bool is_key_available() override { return false; }
+    Key  get_key() override { return Key::Invalid; }
+    void set_input_callback(InputCallback) override {}
+};
+
+void test_shared_highlighters()
+{
+    Buffer buffer("test", Buffer::Flags::None, { "foo bar default\n", "bar foo default\n" });
+
+    // referenced groups colors are shared when several windows display the buffer
+    ClientManager& client_manager = ClientManager::instance();
+    Client* clients[] = {
+        client_manager.create_client(std::unique_ptr<UserInterface>{new TestUI}, ""),
+        client_manager.create_client(std::unique_ptr<UserInterface>{new TestUI}, "")
+    };
+
+    CommandManager& command_manager = CommandManager::instance();
+    command_manager.execute("defhl test_inner; defhl test_outer;"
+                            "addhl -def-group test_inner regex foo 0:red;"
+                            "addhl -def-group test_outer regex bar 0:blue;"
+                            "addhl -def-group test_outer ref test_inner;"
+                            "addhl -def-group test_outer regex def 0:default",
+                            clients[0]->context());
+    for (auto client : clients)
+        command_manager.execute("addhl regex \\w+ 0:yellow; addhl ref test_outer",
+                                client->context());
+
+    for (auto client : clients)
+    {
+        Window& window = client->context().window();
+        window.set_dimensions({ 10, 80 });
+        window.update_display_buffer(client->context());
+
+        // the second line is not selected
+        const DisplayBuffer& display_buffer = window.display_buffer();
+        kak_assert(color_at(display_buffer, {1, 0}) == Colors::Blue);
+        kak_assert(color_at(display_buffer, {1, 4}) == Colors::Red);
+        kak_assert(color_at(display_buffer, {1, 8}) == Colors::Default);
+        kak_assert(color_at(display_buffer, {1, 12}) == Colors::Yellow);
+    }
+
+    // groups are checked again once defined highlighters are modified
+    command_manager.execute("addhl -def-group test_inner number_lines",
+                            clients[0]->context());
+    for (auto client : clients)
+    {
+        Window& window = client->context().window();
+        window.update_display_buffer(client->context());
+        kak_assert(not window.display_buffer().lines()[1].prefix().empty());
+    }
+
+    for (auto client : clients)
+        client_manager.remove_client(*client);
+    DefinedHighlighters& defined = DefinedHighlighters::instance();
+    defined.remove("test_inner");
+    defined.remove("test_outer");
+    defined.notify_modified();
+}
+
 void run_unit_tests()
 {
     test_utf8();
     test_string();
     test_keys();
     test_buffer();
+    test_buffer_changes();
+    test_buffer_cache();
     test_undo_group_optimizer();
+    test_line_regex();
+    test_regex_budget();
+    test_offset_coords();
+    test_highlight_ranges();
+    test_regex_highlighter_cache();
+    test_multi_regex_highlighter();
+    test_syntax_highlighter();
+    test_line_numbers_highlighter();
+    test_flag_lines_highlighter();
+    test_deferred_highlighter();
+    test_shared_highlighters();
 }
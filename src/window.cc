@@ -4,6 +4,7 @@
 #include "context.hh"
 #include "highlighter.hh"
 #include "hook_manager.hh"
+#include "profiler.hh"
 #include "client.hh"
 
 #include <algorithm>
@@ -68,28 +69,40 @@ void Window::scroll(CharCount offset)
 void Window::update_display_buffer(const Context& context)
 {
     kak_assert(&buffer() == &context.buffer());
-    scroll_to_keep_selection_visible_ifn(context);
+    Profiler& profiler = Profiler::instance();
+    profiler.set_enabled(context.options()["profile_highlighters"].get<bool>());
+    profiler.begin_frame();
 
+    scroll_lines_to_keep_selection_visible_ifn(context);
+
+    // the previous frame lines are reused, so that their atom storage
+    // does not need to be allocated again.
     DisplayBuffer::LineList& lines = m_display_buffer.lines();
-    lines.clear();
+    LineCount line_count = std::min(m_dimensions.line,
+                                    buffer().line_count() - m_position.line);
+    lines.resize(std::max(0, (int)line_count));
 
-    for (LineCount line = 0; line < m_dimensions.line; ++line)
+    for (LineCount line = 0; line < line_count; ++line)
     {
         LineCount buffer_line = m_position.line + line;
-        if (buffer_line >= buffer().line_count())
-            break;
-        lines.emplace_back(AtomList{ {buffer(), buffer_line, buffer_line+1} });
+        DisplayLine& display_line = lines[(int)line];
+        display_line.clear();
+        display_line.push_back({buffer(), buffer_line, buffer_line+1});
     }
 
     m_display_buffer.compute_range();
     m_highlighters(context, m_display_buffer);
     m_builtin_highlighters(context, m_display_buffer);
 
-    // cut the start of the line before m_position.column
+    scroll_columns_to_keep_selection_visible_ifn(context);
+
+    // cut the start of the line before m_position.column, the prefix is
+    // always displayed
     for (auto& line : lines)
-        line.trim(m_position.column, m_dimensions.column);
+        line.trim(m_position.column, m_dimensions.column - line.prefix_length());
     m_display_buffer.optimize();
 
+    profiler.end_frame();
     m_timestamp = buffer().timestamp();
 }
 
@@ -116,36 +129,33 @@ static LineCount adapt_view_pos(LineCount line, LineCount offset,
     return view_pos;
 }
 
-static CharCount adapt_view_pos(const DisplayBuffer& display_buffer,
+static CharCount adapt_view_pos(const DisplayLine& line,
                                 BufferCoord pos, CharCount view_pos, CharCount view_size)
 {
     CharCount buffer_column = 0;
-    CharCount non_buffer_column = 0;
-    for (auto& line : display_buffer.lines())
+    CharCount non_buffer_column = line.prefix_length();
+    for (auto& atom : line)
     {
-        for (auto& atom : line)
+        if (atom.has_buffer_range())
         {
-            if (atom.has_buffer_range())
+            if (atom.begin() <= pos and atom.end() > pos)
             {
-                if (atom.begin() <= pos and atom.end() > pos)
-                {
-                    if (buffer_column < view_pos)
-                        return buffer_column;
-
-                    auto last_column = buffer_column + atom.length();
-                    if (last_column >= view_pos + view_size - non_buffer_column)
-                        return last_column - view_size + non_buffer_column;
-                }
-                buffer_column += atom.length();
+                if (buffer_column < view_pos)
+                    return buffer_column;
+
+                auto last_column = buffer_column + atom.length();
+                if (last_column >= view_pos + view_size - non_buffer_column)
+                    return last_column - view_size + non_buffer_column;
             }
-            else
-                non_buffer_column += atom.length();
+            buffer_column += atom.length();
         }
+        else
+            non_buffer_column += atom.length();
     }
     return view_pos;
 }
 
-void Window::scroll_to_keep_selection_visible_ifn(const Context& context)
+void Window::scroll_lines_to_keep_selection_visible_ifn(const Context& context)
 {
     auto& selection = context.selections().main();
     const auto& first = selection.first();
@@ -159,24 +169,46 @@ void Window::scroll_to_keep_selection_visible_ifn(const Context& context)
                                      m_dimensions.line, buffer().line_count());
     m_position.line = adapt_view_pos(last.line,  offset, m_position.line,
                                      m_dimensions.line, buffer().line_count());
+}
+
+void Window::scroll_columns_to_keep_selection_visible_ifn(const Context& context)
+{
+    auto& selection = context.selections().main();
+    const auto& first = selection.first();
+    const auto& last  = selection.last();
+
+    // the line containing the cursor is normally displayed and already
+    // highlighted, else highlight only this line.
+    const DisplayLine* cursor_line = nullptr;
+    for (auto& line : m_display_buffer.lines())
+    {
+        if (line.range().first <= last and last < line.range().second)
+        {
+            cursor_line = &line;
+            break;
+        }
+    }
 
-    // highlight only the line containing the cursor
     DisplayBuffer display_buffer;
-    DisplayBuffer::LineList& lines = display_buffer.lines();
-    lines.emplace_back(AtomList{ {buffer(), last.line, last.line+1} });
+    if (not cursor_line)
+    {
+        DisplayBuffer::LineList& lines = display_buffer.lines();
+        lines.emplace_back(AtomList{ {buffer(), last.line, last.line+1} });
 
-    display_buffer.compute_range();
-    m_highlighters(context, display_buffer);
-    m_builtin_highlighters(context, display_buffer);
+        display_buffer.compute_range();
+        m_highlighters(context, display_buffer);
+        m_builtin_highlighters(context, display_buffer);
+        cursor_line = &lines.front();
+    }
 
     // now we can compute where the cursor is in display columns
     // (this is only valid if highlighting one line and multiple lines put
     // the cursor in the same position, however I do not find any sane example
     // of highlighters not doing that)
-    m_position.column = adapt_view_pos(display_buffer,
+    m_position.column = adapt_view_pos(*cursor_line,
                                        first.line == last.line ? first : last.line,
                                        m_position.column, m_dimensions.column);
-    m_position.column = adapt_view_pos(display_buffer, last,
+    m_position.column = adapt_view_pos(*cursor_line, last,
                                        m_position.column, m_dimensions.column);
 }
 
@@ -228,7 +260,7 @@ DisplayCoord Window::display_position(BufferCoord coord)
     {
         auto& range = line.range();
         if (range.first <= coord and coord < range.second)
-            return {l, find_display_column(line, buffer(), coord)};
+            return {l, line.prefix_length() + find_display_column(line, buffer(), coord)};
         ++l;
     }
     return { 0, 0 };
@@ -241,20 +273,76 @@ BufferCoord Window::offset_coord(BufferCoord coord, CharCount offset)
 
 BufferCoord Window::offset_coord(BufferCoord coord, LineCount offset)
 {
-    auto line = clamp(coord.line + offset, 0_line, buffer().line_count()-1);
-    DisplayBuffer display_buffer;
-    DisplayBuffer::LineList& lines = display_buffer.lines();
-    lines.emplace_back(AtomList{ {buffer(), coord.line, coord.line+1} });
-    lines.emplace_back(AtomList{ {buffer(), line, line+1} });
-    display_buffer.compute_range();
+    return offset_coords(coord, offset).front();
+}
+
+std::vector<BufferCoord> Window::offset_coords(memoryview<BufferCoord> coords,
+                                               CharCount offset)
+{
+    std::vector<BufferCoord> res;
+    for (auto& coord : coords)
+        res.push_back(buffer().offset_coord(coord, offset));
+    return res;
+}
+
+std::vector<BufferCoord> Window::offset_coords(memoryview<BufferCoord> coords,
+                                               LineCount offset)
+{
+    auto target_line = [&](BufferCoord coord) {
+        return clamp(coord.line + offset, 0_line, buffer().line_count()-1);
+    };
 
+    // highlight every source and target line only once
+    std::vector<LineCount> buffer_lines;
+    for (auto& coord : coords)
+    {
+        buffer_lines.push_back(coord.line);
+        buffer_lines.push_back(target_line(coord));
+    }
+    std::sort(buffer_lines.begin(), buffer_lines.end());
+    buffer_lines.erase(std::unique(buffer_lines.begin(), buffer_lines.end()),
+                       buffer_lines.end());
+
+    // lines are highlighted in groups of close lines, so that highlighters
+    // working on the whole displayed range do not scan more lines between
+    // them than highlighting each coord on its own would.
+    const LineCount max_gap = std::max(std::abs((int)offset), 1);
     InputHandler hook_handler{*m_buffer, SelectionList{ {} } };
     hook_handler.context().set_window(*this);
-    m_highlighters(hook_handler.context(), display_buffer);
-    m_builtin_highlighters(hook_handler.context(), display_buffer);
 
-    CharCount column = find_display_column(lines[0], buffer(), coord);
-    return find_buffer_coord(lines[1], buffer(), column);
+    DisplayBuffer::LineList lines;
+    lines.reserve(buffer_lines.size());
+    for (auto group_begin = buffer_lines.begin(); group_begin != buffer_lines.end(); )
+    {
+        auto group_end = group_begin + 1;
+        while (group_end != buffer_lines.end() and *group_end - *(group_end-1) <= max_gap)
+            ++group_end;
+
+        DisplayBuffer display_buffer;
+        DisplayBuffer::LineList& group_lines = display_buffer.lines();
+        for (auto it = group_begin; it != group_end; ++it)
+            group_lines.emplace_back(AtomList{ {buffer(), *it, *it+1} });
+        display_buffer.compute_range();
+
+        m_highlighters(hook_handler.context(), display_buffer);
+        m_builtin_highlighters(hook_handler.context(), display_buffer);
+
+        std::move(group_lines.begin(), group_lines.end(), std::back_inserter(lines));
+        group_begin = group_end;
+    }
+
+    auto display_line = [&](LineCount line) -> const DisplayLine& {
+        auto it = std::lower_bound(buffer_lines.begin(), buffer_lines.end(), line);
+        return lines[it - buffer_lines.begin()];
+    };
+
+    std::vector<BufferCoord> res;
+    for (auto& coord : coords)
+    {
+        CharCount column = find_display_column(display_line(coord.line), buffer(), coord);
+        res.push_back(find_buffer_coord(display_line(target_line(coord)), buffer(), column));
+    }
+    return res;
 }
 
 void Window::on_option_changed(const Option& option)
@@ -51,11 +51,16 @@ public:
 
     BufferCoord offset_coord(BufferCoord coord, CharCount offset);
     BufferCoord offset_coord(BufferCoord coord, LineCount offset);
+
+    // offset every coord, highlighting each involved line only once
+    std::vector<BufferCoord> offset_coords(memoryview<BufferCoord> coords, CharCount offset);
+    std::vector<BufferCoord> offset_coords(memoryview<BufferCoord> coords, LineCount offset);
 private:
     Window(const Window&) = delete;
 
     void on_option_changed(const Option& option) override;
-    void scroll_to_keep_selection_visible_ifn(const Context& context);
+    void scroll_lines_to_keep_selection_visible_ifn(const Context& context);
+    void scroll_columns_to_keep_selection_visible_ifn(const Context& context);
 
     safe_ptr<Buffer> m_buffer;
 